@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// A bump allocator over blocks that double in size from 4KB up to
+// maxBlockBytes, so that many small arenas stay small. Allocations are never
+// freed one by one: clear() frees them all at once and keeps the first block
+// for reuse, so filling a table touches malloc only for the blocks. Not
+// thread-safe.
+class Arena {
+public:
+    explicit Arena(size_t maxBlockBytes = 1 << 20) : _maxBlockBytes(maxBlockBytes) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // align is a power of two no larger than alignof(std::max_align_t), the
+    // alignment of the blocks.
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        size_t offset = (_used + align - 1) & ~(align - 1);
+        if (_blocks.empty() || offset + bytes > _blocks.back().size) {
+            // A larger allocation gets a block of its own size.
+            addBlock(std::max(_nextBlockBytes, bytes));
+            _nextBlockBytes = std::min(_nextBlockBytes * 2, _maxBlockBytes);
+            offset = 0;
+        }
+        _used = offset + bytes;
+        return _blocks.back().data.get() + offset;
+    }
+
+    // A copy of bytes in the arena.
+    const char* copy(const char* data, size_t bytes) {
+        char* p = static_cast<char*>(allocate(bytes, 1));
+        memcpy(p, data, bytes);
+        return p;
+    }
+
+    void clear() {
+        if (_blocks.size() > 1) {
+            _blocks.erase(_blocks.begin() + 1, _blocks.end());
+        }
+        _used = 0;
+        _bytes = _blocks.empty() ? 0 : _blocks.front().size;
+        _nextBlockBytes = _blocks.empty() ? kFirstBlockBytes : std::min(_bytes * 2, _maxBlockBytes);
+    }
+
+    size_t memoryBytes() const { return _bytes; }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void addBlock(size_t bytes) {
+        _blocks.push_back(Block{std::unique_ptr<char[]>(new char[bytes]), bytes});
+        _bytes += bytes;
+        _used = 0;
+    }
+
+    static const size_t kFirstBlockBytes = 4096;
+
+    size_t _maxBlockBytes;
+    size_t _nextBlockBytes = kFirstBlockBytes;
+    std::vector<Block> _blocks;
+    size_t _used = 0;
+    size_t _bytes = 0;
+};
+
+// Hands out memory of an Arena to a standard container and never takes it
+// back, for containers whose elements live until the arena is cleared: node
+// based maps that only grow, say. Clear the container before the arena.
+template <class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena* arena) : _arena(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.arena()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    Arena* arena() const { return _arena; }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const { return _arena == other.arena(); }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return _arena != other.arena(); }
+
+private:
+    Arena* _arena;
+};
@@ -1,131 +1,3117 @@
 #pragma once
 
+#include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <sstream>
-#include <functional>
-#include <queue>
-#include <unordered_map>
+#include <type_traits>
 #include <exception>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <initializer_list>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <random>
 #include "abseil-cpp/absl/hash/hash.h"
+#include "checkpoint.h"
+#include "fingerprint_set.h"
+#include "process_mesh.h"
+#include "state_queue.h"
+#include "state_store.h"
+
+enum class ReportFormat {
+    Text,
+    // One JSON object per line.
+    Json,
+};
+
+enum class SearchStrategy {
+    BreadthFirst,
+    DepthFirst,
+    IterativeDeepening,
+    // Random walks, without a seen set.
+    Simulation,
+    // Many small randomized bounded searches.
+    Swarm,
+};
+
+// How workers share the BFS frontier when there are several.
+enum class Scheduler {
+    // One queue, locked for every state taken and every expansion's successors.
+    Shared,
+    // A deque per worker, with idle workers stealing from the others.
+    Stealing,
+    // The BFS levels one at a time, each shared out among the workers.
+    Levels,
+};
+
+enum class SeenBackend {
+    // A lock-free table in memory.
+    Memory,
+    // A bounded table in memory that spills sorted runs to disk.
+    Disk,
+    // A Bloom filter of a fixed size, which may omit states.
+    Bitstate,
+};
+
+struct CheckerOptions {
+    // --workers=N: number of threads exploring the state space. 1 explores on
+    // the calling thread in strict BFS order, 0 uses one per hardware thread.
+    size_t workers = 1;
+
+    // --scheduler=shared|stealing: how several workers share the frontier.
+    // With stealing, each worker keeps the successors it finds in its own
+    // deque and explores the newest first, moving the oldest to the shared
+    // queue only when it holds more than a few thousand. Idle workers take
+    // states from the shared queue, or steal the older half of another
+    // worker's deque. Such a search no longer runs in BFS order unless it is
+    // --layered, so its traces may not be the shortest.
+    Scheduler scheduler = Scheduler::Shared;
+
+    // --layered: with --scheduler=stealing, explore the BFS levels one after
+    // another. Workers share out the states of the current level and hold
+    // back their successors until every worker is done with it, so the traces
+    // are the shortest. Implied by --max-depth, which needs every state
+    // reached first at its smallest depth. Checkpoints are taken between
+    // levels.
+    bool layered = false;
+
+    // --scheduler=levels explores the BFS levels one after another, in rounds
+    // of up to 64K states of a level. The workers expand a share of the round
+    // each. Then each worker inserts, in BFS order, the successors whose
+    // fingerprints it owns, so every state is reached first from the same
+    // parent as on one worker. The new states are queued in BFS order, and
+    // the first violation in that order is reported: traces are those of a
+    // run with one worker. Does not run with --por.
+
+    // --seen=memory|disk|bitstate: where the fingerprints of seen states are
+    // kept. Bitstate keeps bitstateHashes bits per state in bitstateBytes,
+    // without parent links, so violations come without a trace. Some states
+    // may be omitted; the run ends with an estimate of how likely that was.
+    SeenBackend seenBackend = SeenBackend::Memory;
+
+    // --seen-capacity=N: for the memory backend, the initial number of slots,
+    // 4096 at least; the table doubles when half full, so sizing it up front
+    // only avoids the pauses. For the disk backend, the number of fingerprints
+    // kept in memory.
+    size_t seenCapacity = 1 << 20;
+
+    // --queue-memory=N: number of unvisited states kept in memory. The rest of
+    // the BFS frontier is spilled to disk. 0 keeps the whole frontier in memory.
+    size_t queueMemory = 0;
+
+    // --disk-dir=DIR: where the disk backends write their files.
+    std::string diskDirectory = "/tmp";
+
+    // --fingerprints-only clears this. Keep a full copy of every unique state
+    // for printing error traces. Without it only fingerprints and parent links
+    // are kept, and a trace is rebuilt by replaying generate() from the
+    // initial states.
+    bool keepStates = true;
+
+    // --report-interval=SECONDS: how often progress is printed. 0 disables it.
+    double reportInterval = 1;
+
+    // --report-format=text|json
+    ReportFormat reportFormat = ReportFormat::Text;
+
+    // --por: partial-order reduction over the actions a model annotates with
+    // action(). See ActionFootprint.
+    bool partialOrder = false;
+
+    // --search=bfs|dfs|iddfs: the exploration order. BFS finds the shortest
+    // traces. DFS keeps only the current path and its siblings besides the
+    // seen set, and tends to reach deep bugs sooner. Iterative deepening runs
+    // depth-bounded DFS with the bound raised by depthStep each round, until
+    // a round is cut short nowhere. DFS and iterative deepening run on one
+    // thread. Simulation runs --walks random walks of up to --max-depth steps
+    // (100 if unset) on the workers, checking the invariant on every state.
+    // Swarm runs --searches independent DFS to --max-depth (100 if unset) on
+    // the workers. Each one enumerates successors in its own random order and
+    // tracks seen states in its own --bitstate-bytes table under its own hash
+    // seed, so the searches omit different states. The first violation stops
+    // them all.
+    SearchStrategy search = SearchStrategy::BreadthFirst;
+
+    // --depth-step=N: how much iterative deepening raises the bound per round.
+    uint32_t depthStep = 8;
+
+    // --max-depth=N: only states within N steps of an initial state are
+    // checked, with every strategy. 0 is unbounded.
+    uint32_t maxDepth = 0;
+
+    // --walks=N: number of random walks in a simulation.
+    uint64_t walks = 10000;
+
+    // --seed=N: the seed of the random walks and swarm searches. Walk or
+    // search i depends only on the seed and i, so a run can be reproduced
+    // with any number of workers. 0 picks a seed, which is printed.
+    uint64_t seed = 0;
+
+    // --searches=N: number of searches in a swarm.
+    uint64_t searches = 64;
+
+    // --bitstate-bytes=N: the size of the bitstate table, of the run or of
+    // each swarm search.
+    size_t bitstateBytes = 1 << 22;
+
+    // --bitstate-hashes=K: bits set per state in a bitstate table, at most 64.
+    unsigned bitstateHashes = 3;
+
+    // --checkpoint=FILE: every checkpointInterval seconds, pause a
+    // breadth-first search and save the seen set, the stored states, the queue
+    // and the stats to FILE. The previous checkpoint is replaced only once the
+    // new one is complete.
+    std::string checkpointPath;
+
+    // --checkpoint-interval=SECONDS
+    double checkpointInterval = 600;
+
+    // --resume=FILE: continue the breadth-first search saved in FILE instead
+    // of starting from the initial states. The model and the options that
+    // shape the tables (--seen, --fingerprints-only, --por, --bitstate-*)
+    // must be those of the saved run; --workers and the queue and report
+    // options may change. A model whose states are neither flat nor encoded
+    // by serialize() is fingerprinted with absl::Hash, which is seeded per
+    // process, so its runs cannot resume.
+    std::string resumePath;
+
+    // --processes=N: explore in N processes on this machine, forked from this
+    // one and connected by Unix sockets. Each process owns the states whose
+    // fingerprints hash to it, keeps their part of the seen set, the stored
+    // states and the queue, and explores them on one thread; successors are
+    // sent to their owners in batches. The processes do not keep in step, so
+    // an error trace is valid but may be longer than the shortest. Only
+    // breadth-first search with --seen=memory or disk runs this way, without
+    // --por, checkpoints or --deterministic, and --workers does not apply.
+    size_t processes = 1;
+
+    // --deterministic: make the counters, the violation reported and its
+    // trace depend only on the model and the options, not on the number of
+    // workers or their timing. A breadth-first search with several workers
+    // runs with --scheduler=levels, or on one worker with --por. Walks and
+    // swarm searches run in rounds, and the first of them in order with a
+    // violation reports it. Other searches run on one worker already.
+    // Does not run with --processes.
+    bool deterministic = false;
+
+    // Recognizes the flags above. Other arguments are left to the model.
+    static CheckerOptions fromArgs(int argc, char** argv) {
+        CheckerOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&](const char* flag) -> const char* {
+                size_t len = strlen(flag);
+                return arg.compare(0, len, flag) == 0 ? argv[i] + len : nullptr;
+            };
+            if (auto v = value("--workers=")) {
+                options.workers = strtoul(v, nullptr, 10);
+            } else if (auto v = value("--scheduler=")) {
+                options.scheduler = choose<Scheduler>(arg, v, {{"shared", Scheduler::Shared},
+                                                               {"stealing", Scheduler::Stealing},
+                                                               {"levels", Scheduler::Levels}});
+            } else if (arg == "--layered") {
+                options.layered = true;
+            } else if (auto v = value("--seen=")) {
+                options.seenBackend = choose<SeenBackend>(arg, v, {{"memory", SeenBackend::Memory},
+                                                                   {"disk", SeenBackend::Disk},
+                                                                   {"bitstate", SeenBackend::Bitstate}});
+            } else if (auto v = value("--seen-capacity=")) {
+                options.seenCapacity = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--queue-memory=")) {
+                options.queueMemory = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--disk-dir=")) {
+                options.diskDirectory = v;
+            } else if (arg == "--fingerprints-only") {
+                options.keepStates = false;
+            } else if (auto v = value("--report-interval=")) {
+                options.reportInterval = strtod(v, nullptr);
+            } else if (auto v = value("--report-format=")) {
+                options.reportFormat = choose<ReportFormat>(arg, v, {{"text", ReportFormat::Text},
+                                                                     {"json", ReportFormat::Json}});
+            } else if (arg == "--por") {
+                options.partialOrder = true;
+            } else if (auto v = value("--search=")) {
+                options.search = choose<SearchStrategy>(arg, v, {{"bfs", SearchStrategy::BreadthFirst},
+                                                                {"dfs", SearchStrategy::DepthFirst},
+                                                                {"iddfs", SearchStrategy::IterativeDeepening},
+                                                                {"simulate", SearchStrategy::Simulation},
+                                                                {"swarm", SearchStrategy::Swarm}});
+            } else if (auto v = value("--depth-step=")) {
+                options.depthStep = std::max(1ul, strtoul(v, nullptr, 10));
+            } else if (auto v = value("--max-depth=")) {
+                options.maxDepth = strtoul(v, nullptr, 10);
+            } else if (auto v = value("--walks=")) {
+                options.walks = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--seed=")) {
+                options.seed = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--searches=")) {
+                options.searches = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--bitstate-bytes=")) {
+                options.bitstateBytes = strtoull(v, nullptr, 10);
+            } else if (auto v = value("--bitstate-hashes=")) {
+                options.bitstateHashes = strtoul(v, nullptr, 10);
+            } else if (auto v = value("--checkpoint=")) {
+                options.checkpointPath = v;
+            } else if (auto v = value("--checkpoint-interval=")) {
+                options.checkpointInterval = strtod(v, nullptr);
+            } else if (auto v = value("--resume=")) {
+                options.resumePath = v;
+            } else if (arg == "--deterministic") {
+                options.deterministic = true;
+            } else if (auto v = value("--processes=")) {
+                options.processes = std::max(1ul, strtoul(v, nullptr, 10));
+            }
+        }
+        return options;
+    }
+
+private:
+    // The value named v among choices. Any other value ends the program: a
+    // misspelled one must not run the search some other way.
+    template <class E>
+    static E choose(const std::string& arg, const char* v,
+                    std::initializer_list<std::pair<const char*, E>> choices) {
+        for (auto& choice : choices) {
+            if (strcmp(v, choice.first) == 0) return choice.second;
+        }
+        std::cerr << "Unknown value in " << arg << "; expected one of:";
+        for (auto& choice : choices) {
+            std::cerr << " " << choice.first;
+        }
+        std::cerr << "." << std::endl;
+        exit(1);
+    }
+};
+
+// Varints: 7 bits per byte, low bits first, the top bit set on all but the
+// last byte. Values below 128 take one byte.
+inline void writeVarint(std::string& out, uint64_t v) {
+    char bytes[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        bytes[n++] = char(v | 0x80);
+        v >>= 7;
+    }
+    bytes[n++] = char(v);
+    out.append(bytes, n);
+}
+
+inline uint64_t readVarint(const char*& in) {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *in++;
+        v |= uint64_t(byte & 0x7f) << shift;
+        if (byte < 0x80) return v;
+    }
+}
+
+// How one field of a state is encoded by encodeFields(). Integers are varints,
+// signed ones zigzag-encoded so that small negative values stay short, and
+// enums are encoded as their underlying integers. Containers are their size
+// followed by their elements. Types with serialize() and deserialize() use
+// them, and other trivially copyable types are copied byte for byte. Models
+// may specialize it for their own types.
+template <class T, class = void>
+struct FieldCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Specialize FieldCodec or define serialize() and deserialize() for this field.");
+    static void encode(const T& v, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+    static T decode(const char*& in) {
+        T v;
+        memcpy(static_cast<void*>(&v), in, sizeof(T));
+        in += sizeof(T);
+        return v;
+    }
+};
+
+template <class T>
+struct FieldCodec<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type> {
+    static void encode(const T& v, std::string& out) { writeVarint(out, v); }
+    static T decode(const char*& in) { return T(readVarint(in)); }
+};
+
+template <class T>
+struct FieldCodec<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+    static void encode(const T& v, std::string& out) {
+        writeVarint(out, (uint64_t(v) << 1) ^ uint64_t(int64_t(v) >> 63));
+    }
+    static T decode(const char*& in) {
+        uint64_t u = readVarint(in);
+        return T(int64_t(u >> 1) ^ -int64_t(u & 1));
+    }
+};
+
+template <class T>
+struct FieldCodec<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+    using Underlying = typename std::underlying_type<T>::type;
+    static void encode(const T& v, std::string& out) { FieldCodec<Underlying>::encode(Underlying(v), out); }
+    static T decode(const char*& in) { return T(FieldCodec<Underlying>::decode(in)); }
+};
+
+template <class T>
+struct FieldCodec<T, decltype(std::declval<const T&>().serialize(std::declval<std::string&>()))> {
+    static void encode(const T& v, std::string& out) { v.serialize(out); }
+    static T decode(const char*& in) { return T::deserialize(in); }
+};
+
+template <class T, class A>
+struct FieldCodec<std::vector<T, A>> {
+    static void encode(const std::vector<T, A>& v, std::string& out) {
+        writeVarint(out, v.size());
+        for (const auto& e : v) FieldCodec<T>::encode(e, out);
+    }
+    static std::vector<T, A> decode(const char*& in) {
+        size_t n = readVarint(in);
+        std::vector<T, A> v;
+        v.reserve(n);
+        for (size_t i = 0; i < n; i++) v.push_back(FieldCodec<T>::decode(in));
+        return v;
+    }
+};
+
+template <class T, size_t N>
+struct FieldCodec<std::array<T, N>> {
+    static void encode(const std::array<T, N>& v, std::string& out) {
+        for (const auto& e : v) FieldCodec<T>::encode(e, out);
+    }
+    static std::array<T, N> decode(const char*& in) {
+        std::array<T, N> v;
+        for (auto& e : v) e = FieldCodec<T>::decode(in);
+        return v;
+    }
+};
+
+template <>
+struct FieldCodec<std::string> {
+    static void encode(const std::string& v, std::string& out) {
+        writeVarint(out, v.size());
+        out.append(v);
+    }
+    static std::string decode(const char*& in) {
+        size_t n = readVarint(in);
+        std::string v(in, n);
+        in += n;
+        return v;
+    }
+};
+
+// Appends the fields in order, for serialize().
+template <class... T>
+void encodeFields(std::string& out, const T&... fields) {
+    int unused[] = {0, (FieldCodec<T>::encode(fields, out), 0)...};
+    (void)unused;
+}
+
+// Decodes the fields in the order encodeFields() wrote them, for deserialize().
+template <class... T>
+void decodeFields(const char*& in, T&... fields) {
+    int unused[] = {0, (fields = FieldCodec<T>::decode(in), 0)...};
+    (void)unused;
+}
+
+// How states are encoded when they are spilled to disk, saved in checkpoints
+// or sent elsewhere. Trivially copyable states are copied byte for byte by
+// default. Other models, and flat ones that want a more compact encoding,
+// define
+//     void serialize(std::string& out) const;  // Appends the encoding to out.
+//     static StateType deserialize(const char*& in);  // Decodes one state and advances in.
+// usually with the field helpers. States that are not flat are also
+// fingerprinted by their encoding, so equal states must encode the same:
+//     void serialize(std::string& out) const { encodeFields(out, term, role, log); }
+//     static State deserialize(const char*& in) {
+//         State s;
+//         decodeFields(in, s.term, s.role, s.log);
+//         return s;
+//     }
+template <class StateType, class = void>
+struct StateCodec {
+    static_assert(std::is_trivially_copyable<StateType>::value,
+                  "Define serialize() and deserialize() for states that are not trivially copyable.");
+    // Whether a state is encoded as its own bytes.
+    static const bool kRawBytes = true;
+    static void encode(const StateType& s, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&s), sizeof(StateType));
+    }
+    static StateType decode(const char*& in) {
+        StateType s;
+        memcpy(static_cast<void*>(&s), in, sizeof(StateType));
+        in += sizeof(StateType);
+        return s;
+    }
+};
+
+template <class StateType>
+struct StateCodec<StateType, decltype(std::declval<const StateType&>().serialize(std::declval<std::string&>()))> {
+    static const bool kRawBytes = false;
+    static void encode(const StateType& s, std::string& out) { s.serialize(out); }
+    static StateType decode(const char*& in) { return StateType::deserialize(in); }
+};
+
+// A list of states that keeps its elements alive when cleared, so refilling
+// it copy-assigns into states whose containers already have capacity.
+template <class StateType>
+class StateBuffer {
+public:
+    void clear() { _size = 0; }
+    void push_back(const StateType& s) {
+        if (_size < _states.size()) {
+            _states[_size] = s;
+        } else {
+            _states.push_back(s);
+        }
+        _size++;
+    }
+    size_t size() const { return _size; }
+    const StateType* data() const { return _states.data(); }
+    const StateType* begin() const { return _states.data(); }
+    const StateType* end() const { return _states.data() + _size; }
+
+private:
+    std::vector<StateType> _states;
+    size_t _size = 0;
+};
+
+// Flat states are trivially copyable and have no padding, so their bytes are
+// determined by their value. They take a fast path chosen at compile time:
+// they are hashed and compared as raw bytes, and stored packed next to their
+// fingerprints instead of in map nodes. Detection is automatic. A model whose
+// AbslHashValue or operator== deliberately ignores some of its bytes must opt
+// out by specializing IsFlatState to std::false_type, and a model with padding
+// that it keeps zeroed may opt in with std::true_type.
+template <class StateType>
+struct IsFlatState : std::integral_constant<bool,
+        std::is_trivially_copyable<StateType>::value &&
+        __has_unique_object_representations(StateType)> {};
+
+// Hashes size bytes 16 at a time with a 64x64->128 bit multiply mix, after
+// wyhash. States are a few words long, and for a flat state size is a
+// compile-time constant, so once inlined the loop unrolls into straight-line
+// code. The seed is fixed, so a state has the same fingerprint in every
+// process.
+inline uint64_t hashBytesLane(const void* data, size_t size, uint64_t seed, uint64_t prime) {
+    const uint64_t kP0 = 0xa0761d6478bd642full;
+    auto mix = [](uint64_t a, uint64_t b) {
+        __uint128_t r = __uint128_t(a) * b;
+        return uint64_t(r) ^ uint64_t(r >> 64);
+    };
+    auto p = static_cast<const unsigned char*>(data);
+    uint64_t h = kP0 ^ size ^ seed;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint64_t a, b;
+        memcpy(&a, p + i, 8);
+        memcpy(&b, p + i + 8, 8);
+        h = mix(a ^ prime, b ^ h);
+    }
+    if (i < size) {
+        uint64_t a = 0, b = 0;
+        memcpy(&a, p + i, std::min<size_t>(size - i, 8));
+        if (size - i > 8) memcpy(&b, p + i + 8, size - i - 8);
+        h = mix(a ^ prime, b ^ h);
+    }
+    return mix(prime ^ size, h);
+}
+
+// A 128-bit fingerprint is two lanes with their own seeds and primes, so a
+// collision in one is independent of the other.
+inline Fingerprint hashBytes(const void* data, size_t size) {
+    const uint64_t kP1 = 0xe7037ed1a0b428dbull;
+#ifdef CHECKER_FINGERPRINT_128
+    const uint64_t kSeed2 = 0x8ebc6af09c88c6e3ull, kP2 = 0x589965cc75374cc3ull;
+    return Fingerprint(hashBytesLane(data, size, 0, kP1)) << 64 | hashBytesLane(data, size, kSeed2, kP2);
+#else
+    return hashBytesLane(data, size, 0, kP1);
+#endif
+}
+
+template <size_t Size>
+Fingerprint hashBytes(const void* data) {
+    return hashBytes(data, Size);
+}
 
-using Fingerprint = uint64_t;
+// A state waiting to be explored, with its BFS depth.
+template <class StateType>
+struct QueuedState {
+    StateType state;
+    uint32_t depth;
+};
+
+template <class StateType>
+struct QueuedStateCodec {
+    static void encode(const QueuedState<StateType>& s, std::string& out) {
+        writeVarint(out, s.depth);
+        StateCodec<StateType>::encode(s.state, out);
+    }
+    static QueuedState<StateType> decode(const char*& in) {
+        uint32_t depth = readVarint(in);
+        return QueuedState<StateType>{StateCodec<StateType>::decode(in), depth};
+    }
+};
+
+// The smallest depth each state was reached at, so that depth-bounded DFS
+// explores a state again when it finds a shorter path to it. Not thread-safe.
+class DepthTable {
+public:
+    void reset() {
+        _slots.assign(1 << 10, Slot{kEmpty, 0});
+        _size = 0;
+    }
+
+    // Records depth for fp and returns true if fp was not reached as shallow before.
+    bool improve(Fingerprint fp, uint32_t depth) {
+        if ((_size + 1) * 2 > _slots.size()) grow();
+        Slot& slot = find(fingerprintKey(fp));
+        if (slot.key == kEmpty) {
+            slot = Slot{fingerprintKey(fp), depth};
+            _size++;
+            return true;
+        }
+        if (depth >= slot.depth) return false;
+        slot.depth = depth;
+        return true;
+    }
+
+    size_t memoryBytes() const { return _slots.size() * sizeof(Slot); }
+
+private:
+    static const uint64_t kEmpty = 0;
+
+    struct Slot {
+        Fingerprint key;
+        uint32_t depth;
+    };
+
+    Slot& find(Fingerprint key) {
+        size_t mask = _slots.size() - 1;
+        size_t i = key & mask;
+        while (_slots[i].key != kEmpty && _slots[i].key != key) i = (i + 1) & mask;
+        return _slots[i];
+    }
+
+    void grow() {
+        std::vector<Slot> old(_slots.size() * 2, Slot{kEmpty, 0});
+        old.swap(_slots);
+        for (auto& slot : old) {
+            if (slot.key != kEmpty) find(slot.key) = slot;
+        }
+    }
+
+    std::vector<Slot> _slots;
+    size_t _size = 0;
+};
+
+// A small, fast generator for random walks (splitmix64). Cheap to seed, so
+// each walk gets its own stream.
+class WalkRandom {
+public:
+    WalkRandom(uint64_t seed, uint64_t walk) : _state(seed ^ (walk * 0x9e3779b97f4a7c15ull)) {
+        next();
+    }
+    uint64_t next() {
+        uint64_t z = (_state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    // Uniform in [0, n).
+    size_t below(size_t n) { return size_t((__uint128_t(next()) * n) >> 64); }
+
+private:
+    uint64_t _state;
+};
+
+// Returns seed, or a random one for 0.
+inline uint64_t pickSeed(uint64_t seed) {
+    while (seed == 0) {
+        seed = (uint64_t(std::random_device()()) << 32) | std::random_device()();
+    }
+    return seed;
+}
+
+// Runs a task every interval seconds on its own thread until destroyed.
+class PeriodicTask {
+public:
+    PeriodicTask(double interval, std::function<void()> task) {
+        if (interval <= 0) return;
+        _thread = std::thread([this, interval, task]() {
+            auto period = std::chrono::duration<double>(interval);
+            std::unique_lock<std::mutex> lk(_mutex);
+            while (!_stopped) {
+                uint64_t restarts = _restarts;
+                if (!_cv.wait_for(lk, period, [&]() { return _stopped || _restarts != restarts; })) {
+                    task();
+                }
+            }
+        });
+    }
+
+    // Starts the current interval over. The task does not run again until a
+    // whole interval after this returns.
+    void restart() {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _restarts++;
+        }
+        _cv.notify_all();
+    }
+    ~PeriodicTask() {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _stopped = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopped = false;
+    uint64_t _restarts = 0;
+    std::thread _thread;
+};
+
+// Symmetry reduction. A model whose indices 0..N-1 (node ids, say) are
+// interchangeable declares
+//
+//     static const size_t kSymmetricIndices = N;
+//     // Orders two indices by the state they own, ignoring their identity.
+//     bool symmetricLess(size_t a, size_t b) const;
+//     // Moves whatever index i owns to p[i], and renames i to p[i] wherever
+//     // it is stored as a value.
+//     void permute(const Permutation<N>& p);
+//
+// and every state is fingerprinted as the canonical member of its orbit, so
+// states that only differ by a renaming of the indices are explored once.
+// States in an error trace may then use different namings from step to step.
+template <size_t N>
+class Permutation {
+    static_assert(N > 0 && N <= 256, "Permutation indices must fit in a byte.");
+public:
+    Permutation() {
+        for (size_t i = 0; i < N; i++) _to[i] = i;
+    }
+    size_t operator[](size_t i) const { return _to[i]; }
+    void set(size_t from, size_t to) { _to[from] = to; }
+
+    // Moves seq[i] to seq[p[i]] for a sequence indexed by the symmetric indices.
+    template <class Seq>
+    void apply(Seq& seq) const {
+        Seq old = seq;
+        for (size_t i = 0; i < N; i++) {
+            seq[_to[i]] = old[i];
+        }
+    }
+
+private:
+    std::array<uint8_t, N> _to;
+};
+
+template <class StateType, class = void>
+struct HasSymmetry : std::false_type {};
+
+template <class StateType>
+struct HasSymmetry<StateType, decltype(std::declval<StateType&>().permute(
+        std::declval<const Permutation<StateType::kSymmetricIndices>&>()))> : std::true_type {};
+
+// Returns the canonical member of the orbit of s. Sorting the indices by
+// symmetricLess already fixes the place of every index whose state differs
+// from the others, in O(N log N) comparisons. Only runs of tied indices are
+// left, and a run is enumerated only if swapping its members changes the
+// state (when they also differ by how other indices refer to them); the
+// candidate with the smallest hash is then the representative.
+template <class StateType, class Hash>
+StateType canonicalState(const StateType& s, Hash hash) {
+    const size_t N = StateType::kSymmetricIndices;
+    std::array<uint8_t, N> order;
+    for (size_t i = 0; i < N; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return s.symmetricLess(a, b);
+    });
+    Permutation<N> sorting;
+    for (size_t k = 0; k < N; k++) {
+        sorting.set(order[k], k);
+    }
+    StateType canonical = s;
+    canonical.permute(sorting);
+
+    // Runs [begin, end) of tied positions whose order still matters.
+    std::array<std::pair<uint8_t, uint8_t>, N> runs;
+    size_t runCount = 0;
+    for (size_t begin = 0, end; begin < N; begin = end) {
+        end = begin + 1;
+        while (end < N && !s.symmetricLess(order[end - 1], order[end])) end++;
+        for (size_t k = begin + 1; k < end; k++) {
+            Permutation<N> swap;
+            swap.set(k - 1, k);
+            swap.set(k, k - 1);
+            StateType swapped = canonical;
+            swapped.permute(swap);
+            if (!(swapped == canonical)) {
+                runs[runCount++] = {uint8_t(begin), uint8_t(end)};
+                break;
+            }
+        }
+    }
+    if (runCount == 0) return canonical;
+
+    std::array<uint8_t, N> positions;
+    for (size_t i = 0; i < N; i++) positions[i] = i;
+    StateType best = canonical;
+    Fingerprint bestFp = hash(canonical);
+    for (;;) {
+        // Steps to the next combination of orders of the runs, like an odometer.
+        size_t r = 0;
+        while (r < runCount && !std::next_permutation(positions.begin() + runs[r].first,
+                                                      positions.begin() + runs[r].second)) {
+            r++;
+        }
+        if (r == runCount) break;
+
+        Permutation<N> p;
+        for (size_t k = 0; k < N; k++) {
+            p.set(k, positions[k]);
+        }
+        StateType candidate = canonical;
+        candidate.permute(p);
+        Fingerprint fp = hash(candidate);
+        if (fp < bestFp) {
+            best = candidate;
+            bestFp = fp;
+        }
+    }
+    return best;
+}
+
+// Partial-order reduction. A model numbers its variables (up to 64, e.g. one
+// per node-local field) and reports every action instance from generate()
+// with the variables it reads and writes:
+//
+//     action({reads, writes}, enabled, [&]() { ... });
+//     action({reads, writes, guard}, enabled, [&]() { ... });
+//
+// Reads include what the guard reads, and guard narrows them down to the
+// variables enabled depends on. Disabled actions must be reported too, so
+// the checker knows what could become enabled. The model also declares
+//
+//     static const uint64_t kVisibleVariables;  // Read by satisfyInvariant() or satisfyConstraint().
+//
+// With --por, a state is expanded only through a persistent subset of its
+// enabled actions, computed as a stubborn set over the footprints. The set
+// contains no action writing a visible variable, so invariant checking stays
+// sound. When one of the subset's successors was already seen, the state is
+// expanded fully, which is the BFS form of the cycle proviso. Successors
+// generated outside action() depend on everything.
+struct ActionFootprint {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t guard;
+
+    ActionFootprint(uint64_t reads, uint64_t writes) : reads(reads), writes(writes), guard(reads) {}
+    ActionFootprint(uint64_t reads, uint64_t writes, uint64_t guard)
+        : reads(reads), writes(writes), guard(guard) {}
+
+    bool dependsOn(const ActionFootprint& other) const {
+        return (writes & (other.reads | other.writes)) || (other.writes & reads);
+    }
+};
+
+// An action reported by generate(), and the range of successors it produced.
+struct ActionRecord {
+    ActionFootprint footprint;
+    bool enabled;
+    size_t begin;
+    size_t end;
+};
+
+// Picks the enabled actions to explore. Each enabled invisible action seeds
+// a closure: an enabled action pulls in every action dependent on it, and a
+// disabled one every action that could enable it by writing what it reads.
+// Returns false if no closure is smaller than the set of enabled actions.
+inline bool persistentSubset(const std::vector<ActionRecord>& actions, uint64_t visible,
+                             std::vector<bool>* subset) {
+    size_t enabled = std::count_if(actions.begin(), actions.end(),
+                                   [](const ActionRecord& a) { return a.enabled; });
+    size_t best = enabled;
+    std::vector<bool> closure;
+    std::vector<size_t> pending;
+    for (size_t seed = 0; seed < actions.size(); seed++) {
+        if (!actions[seed].enabled || actions[seed].begin == actions[seed].end) continue;
+        closure.assign(actions.size(), false);
+        closure[seed] = true;
+        pending.assign(1, seed);
+        size_t closureEnabled = 0;
+        bool valid = true;
+        while (!pending.empty() && valid) {
+            const auto& t = actions[pending.back()];
+            pending.pop_back();
+            if (t.enabled) {
+                closureEnabled++;
+                valid = (t.footprint.writes & visible) == 0 && closureEnabled < best;
+            }
+            for (size_t i = 0; i < actions.size() && valid; i++) {
+                if (closure[i]) continue;
+                bool needed = t.enabled ? t.footprint.dependsOn(actions[i].footprint)
+                                        : (actions[i].footprint.writes & t.footprint.guard) != 0;
+                if (needed) {
+                    closure[i] = true;
+                    pending.push_back(i);
+                }
+            }
+        }
+        if (valid) {
+            best = closureEnabled;
+            *subset = closure;
+        }
+    }
+    return best < enabled;
+}
+
+template <class StateType, class = void>
+struct VisibleVariables : std::integral_constant<uint64_t, ~uint64_t(0)> {};
+
+template <class StateType>
+struct VisibleVariables<StateType, decltype(void(StateType::kVisibleVariables))>
+    : std::integral_constant<uint64_t, StateType::kVisibleVariables> {};
+
+// A state encoded by StateCodec in size bytes, read in place. Without
+// symmetry, a flat state encoded as its own bytes and a state that is not
+// flat and encoded by serialize() are fingerprinted straight from the
+// buffer, so states received or read back in bulk can be deduplicated
+// before any of them is decoded. Other states are decoded to be
+// fingerprinted.
+template <class StateType>
+class EncodedState {
+public:
+    EncodedState(const char* data, size_t size) : _data(data), _size(size) {}
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // The same as decode().hash().
+    Fingerprint fingerprint() const { return fingerprint(InPlace()); }
+
+    StateType decode() const {
+        const char* in = _data;
+        return StateCodec<StateType>::decode(in);
+    }
+
+private:
+    // Those are the states hash() fingerprints by the bytes they encode to.
+    using InPlace = std::integral_constant<bool, StateCodec<StateType>::kRawBytes ==
+            IsFlatState<StateType>::value && !HasSymmetry<StateType>::value>;
+
+    Fingerprint fingerprint(std::true_type) const { return hashBytes(_data, _size); }
+    Fingerprint fingerprint(std::false_type) const { return decode().hash(); }
+
+    const char* _data;
+    size_t _size;
+};
+
+template <class StateType>
+struct ModelState;
 
 template <class StateType>
 class Checker {
 public:
-    void run(std::vector<StateType> initialStates);
+    void run(std::vector<StateType> initialStates, CheckerOptions options = CheckerOptions());
     void onNewState(const StateType&);
     std::string getStats() const;
 
-    static Checker<StateType>* get() { return globalChecker; }
+    static Checker<StateType>* get() { return globalChecker; }
+
+    struct Stats {
+        std::atomic<uint64_t> generated{0};
+        std::atomic<uint64_t> unique{0};
+        // States waiting in the queue and the deepest BFS level being explored.
+        std::atomic<uint64_t> queued{0};
+        std::atomic<uint64_t> depth{0};
+        // Memory of the seen set and trace store, refreshed whenever they grow.
+        std::atomic<uint64_t> seenBytes{0};
+
+        void reset() {
+            generated = 0;
+            unique = 0;
+            queued = 0;
+            depth = 0;
+            seenBytes = 0;
+        }
+        friend std::ostream& operator << (std::ostream &out, const Stats& s) {
+            return out << "generated: " << s.generated.load() << " unique: " << s.unique.load();
+        }
+    };
+    // Counters of the current or last run.
+    const Stats& stats() const { return _stats; }
+
+private:
+    // Prints the progress line, with rates since the previous report.
+    class Reporter {
+    public:
+        Reporter(const Stats& stats, ReportFormat format)
+            : _stats(stats), _format(format), _lastGenerated(stats.generated), _lastUnique(stats.unique) {}
+        void report();
+    private:
+        const Stats& _stats;
+        ReportFormat _format;
+        std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point _last = _start;
+        uint64_t _lastGenerated;
+        uint64_t _lastUnique;
+    };
+    using TraceStore = typename std::conditional<IsFlatState<StateType>::value,
+            FlatStateStore<StateType>, ShardedStateStore<StateType, StateCodec<StateType>>>::type;
+
+    static Checker<StateType>* globalChecker;
+    void explore(const QueuedState<StateType>& cur);
+    void exploreBatch();
+    void generateSuccessors(const StateType& curState, StateBuffer<StateType>& successors) const;
+    void appendSuccessors(const StateType& curState, StateBuffer<StateType>& successors) const;
+    void checkStates(const StateType* states, size_t n, Fingerprint parent, uint32_t depth);
+    void checkBatch(const StateType* states, size_t n, const Fingerprint* parents, uint32_t depth);
+    void onAction(const ActionFootprint& footprint, bool enabled, size_t begin);
+    void checkNewState(const StateType& state, Fingerprint fp, uint32_t depth);
+    void enqueue(const StateType& state, uint32_t depth);
+    QueuedState<StateType> popUnvisited();
+    void runWorker();
+    void runStealingWorker(size_t id);
+    bool takeShared(WorkerDeque<QueuedState<StateType>>& own, std::vector<QueuedState<StateType>>& taken);
+    bool steal(size_t id, size_t& victim, WorkerDeque<QueuedState<StateType>>& own,
+               std::vector<QueuedState<StateType>>& taken);
+    void publish(std::vector<QueuedState<StateType>>& states);
+    bool awaitWork();
+    void pauseWorkers();
+    void noteDepth(uint32_t depth);
+    void exploreLevels(size_t workers);
+    template <class F>
+    static void parallelFor(size_t workers, size_t n, F&& task);
+    void resetTables(const CheckerOptions& options, size_t initialStates);
+    void searchDepthFirst(const std::vector<StateType>& initialStates, const CheckerOptions& options);
+    void simulate(const std::vector<StateType>& initialStates, const CheckerOptions& options, size_t workers);
+    void swarm(const std::vector<StateType>& initialStates, const CheckerOptions& options, size_t workers);
+    // What a random walk or a swarm search counted and the violation it found.
+    struct TaskTally {
+        uint64_t generated = 0;
+        uint64_t unique = 0;
+        uint64_t depth = 0;
+        std::vector<StateType> trace;
+    };
+    // Walks are short, so a deterministic simulation runs many per round.
+    static const size_t kWalksPerRound = 256;
+    template <class F>
+    uint64_t runTasks(uint64_t n, size_t workers, size_t perWorker, bool deterministic, F&& task);
+    void swarmSearch(const std::vector<StateType>& initialStates, const CheckerOptions& options,
+                     uint64_t seed, uint64_t search, TaskTally& tally);
+    void reportViolation(const std::vector<StateType>& errorTrace, const char* note = nullptr);
+    bool needsGrow() const;
+    void grow();
+    std::string checkpointHeader(const std::vector<StateType>& initialStates, const CheckerOptions& options) const;
+    void writeCheckpoint();
+    void readCheckpoint(const std::string& path);
+
+    // Distributed exploration, with --processes.
+    enum MeshMessage : uint8_t {
+        kStates, kToken, kViolation, kStop, kParentRequest, kParentReply, kProgress, kDone, kFinal,
+    };
+    void exploreDistributed(const std::vector<StateType>& initialStates, const CheckerOptions& options);
+    size_t ownerOf(Fingerprint fp) const;
+    void sendState(const StateType& state, Fingerprint fp, Fingerprint parent, uint32_t depth);
+    void sendStates(size_t process);
+    void receiveStates(const std::string& batch);
+    void answerParentRequest(size_t process, const std::string& request);
+    std::vector<StateType> collectTrace(Fingerprint fp);
+    ProcessMesh::Message awaitMessage(size_t process, uint8_t type);
+    void sendProgress(uint8_t type);
+    void addProgress(size_t process, const std::string& progress);
+    void sumProgress();
+    void finishDistributed();
+    std::vector<StateType> trace(const StateType& endState) const;
+    std::vector<StateType> replayTrace(std::vector<Fingerprint> fps) const;
+
+    std::vector<StateType> _initialStates;
+    bool _keepStates = true;
+    bool _partialOrder = false;
+    std::unique_ptr<FingerprintSet> _seenStates;
+    // With --por, the states whose expansion has started, for the cycle proviso.
+    std::unique_ptr<FingerprintSet> _expandedStates;
+    // States deeper than the bound are not explored, which sets _cutOff.
+    uint32_t _depthBound = UINT32_MAX;
+    std::atomic<bool> _cutOff{false};
+    // The DFS stack, and with a depth bound, the depth of every state reached.
+    std::vector<QueuedState<StateType>> _stack;
+    bool _depthFirst = false;
+    bool _trackDepths = false;
+    DepthTable _depths;
+    TraceStore _traceStates;
+    StateQueue<QueuedState<StateType>, QueuedStateCodec<StateType>> _unvisited;
+    std::mutex _unvisitedMutex;
+    std::condition_variable _unvisitedCv;
+    size_t _busyWorkers = 0;
+    // Set while a worker waits for the others to finish expanding so it can
+    // grow the tables or write a checkpoint.
+    std::atomic<bool> _pausing{false};
+    // With --scheduler=stealing, the deque of every worker, the states they
+    // hold in all and the workers waiting for states. The rest are guarded by
+    // _unvisitedMutex: a counter bumped whenever waiting workers may find
+    // states, whether the search is over, and with --layered, the level
+    // being explored.
+    // Of the states in batches: how many a worker pops from its deque and takes
+    // from the shared queue at once, how many it holds in its deque before
+    // moving some to the shared queue, and with --layered, how many
+    // successors it gathers before publishing them.
+    static const size_t kWorkerBatch = 8;
+    static const size_t kSharedBatch = 64;
+    static const size_t kDequeStates = 4096;
+    static const size_t kPublishStates = 1024;
+    std::vector<std::unique_ptr<WorkerDeque<QueuedState<StateType>>>> _deques;
+    std::atomic<size_t> _dequeStates{0};
+    std::atomic<size_t> _idleWorkers{0};
+    uint64_t _wakeups = 0;
+    bool _searchDone = false;
+    bool _layered = false;
+    uint32_t _layer = 0;
+    // With --scheduler=levels, the states of a round at most.
+    static const size_t kRoundStates = 1 << 16;
+    // On one worker, the successors checked together at most, give or take
+    // those of the last state expanded.
+    static const size_t kBatchSuccessors = 256;
+    // The hash tables grow between expansions, once half full, so the other
+    // half must take whatever the workers add until then: never fewer slots.
+    static const size_t kMinTableSlots = 1 << 12;
+    // Where checkpoints go, whether one is due, the timer that makes them
+    // due, and what a resumed run must agree on with the saved one.
+    std::string _checkpointPath;
+    std::atomic<bool> _checkpointDue{false};
+    PeriodicTask* _checkpointTimer = nullptr;
+    std::string _checkpointHeader;
+    // With --processes, the links to the other processes, and a batch of
+    // states for each of them.
+    std::unique_ptr<ProcessMesh> _mesh;
+    std::vector<std::string> _outgoing;
+    // Batches sent minus batches received, and whether one was received since
+    // the termination token last passed.
+    int64_t _batchBalance = 0;
+    bool _receivedBatch = false;
+    // A state this process found violating the invariant.
+    bool _violationFound = false;
+    Fingerprint _violation = 0;
+    // In rank 0, the last counters of every process: generated, unique,
+    // queued, depth, seen bytes and seen set size. The sums are reported.
+    std::vector<std::array<uint64_t, 6>> _progress;
+    Stats _clusterStats;
+    size_t _remoteSeen = 0;
+    // The states inserted past the violating state by a batch or a round of
+    // --scheduler=levels, which inserting one state at a time would not have
+    // reached. They are left out of the reported size of the seen set, which
+    // then matches the unique states counted.
+    size_t _seenPastViolation = 0;
+    std::atomic<bool> _stopped{false};
+    std::atomic<bool> _violated{false};
+    Stats _stats;
+
+    friend struct ModelState<StateType>;
+    // The states generate() passed to either() on this thread, which are
+    // checked as one batch.
+    static thread_local StateBuffer<StateType>* generatedStates;
+    // The actions generate() reported, with --por.
+    static thread_local std::vector<ActionRecord>* generatedActions;
+    // New states found by the current worker, published to _unvisited in one go.
+    static thread_local std::vector<QueuedState<StateType>>* localSuccessors;
+};
+
+template <class StateType>
+Checker<StateType>* Checker<StateType>::globalChecker = new Checker<StateType>;
+
+template <class StateType>
+thread_local StateBuffer<StateType>* Checker<StateType>::generatedStates = nullptr;
+
+template <class StateType>
+thread_local std::vector<ActionRecord>* Checker<StateType>::generatedActions = nullptr;
+
+template <class StateType>
+thread_local std::vector<QueuedState<StateType>>* Checker<StateType>::localSuccessors = nullptr;
+
+template <class StateType>
+struct ModelState {
+    // The fingerprint, of the canonical member of the orbit for symmetric models.
+    Fingerprint hash() const {
+        return fingerprint(*static_cast<const StateType*>(this), HasSymmetry<StateType>());
+    }
+protected:
+    // Explores the changes fun() makes to the state as one successor, then
+    // undoes them for the next either().
+    template <class F>
+    void either(F&& fun) {
+        if (nesting > 0) {
+            // Inside another either(): restore what the outer fun() has built so far.
+            StateType temp = getState();
+            emit(fun);
+            getState() = std::move(temp);
+            return;
+        }
+        // The copy is kept per thread and assigned to both ways, which reuses
+        // the capacity of any containers instead of allocating.
+        StateType& saved = savedState();
+        saved = getState();
+        emit(fun);
+        getState() = saved;
+    }
+
+    // Like either(fun), with undo() reverting the changes of fun() instead of
+    // a copy of the whole state, for models whose actions have cheap inverses.
+    // Building with -DCHECKER_VERIFY_UNDO checks that undo() restores the
+    // state, at the cost of the copy the overload avoids.
+    template <class F, class U>
+    void either(F&& fun, U&& undo) {
+#ifdef CHECKER_VERIFY_UNDO
+        StateType before = getState();
+#endif
+        emit(fun);
+        undo();
+#ifdef CHECKER_VERIFY_UNDO
+        if (!equal(getState(), before, IsFlatState<StateType>())) {
+            std::cerr << "undo() did not restore the state." << std::endl;
+            abort();
+        }
+#endif
+    }
+
+    // Like either(fun) if enabled, for an action annotated for partial-order
+    // reduction. See ActionFootprint.
+    template <class F>
+    void action(const ActionFootprint& footprint, bool enabled, F&& fun) {
+        auto& generated = Checker<StateType>::generatedStates;
+        size_t begin = generated ? generated->size() : 0;
+        if (enabled) either(fun);
+        if (nesting == 0 && Checker<StateType>::generatedActions) {
+            Checker<StateType>::get()->onAction(footprint, enabled, begin);
+        }
+    }
+
+private:
+    static Fingerprint fingerprint(const StateType& s, std::false_type) {
+        return hashState(s, IsFlatState<StateType>());
+    }
+    static Fingerprint fingerprint(const StateType& s, std::true_type) {
+        auto hash = [](const StateType& c) { return hashState(c, IsFlatState<StateType>()); };
+        return hash(canonicalState(s, hash));
+    }
+    static Fingerprint hashState(const StateType& s, std::true_type) {
+        return hashBytes<sizeof(StateType)>(&s);
+    }
+    static Fingerprint hashState(const StateType& s, std::false_type) {
+        return hashEncoded(s, std::integral_constant<bool, !StateCodec<StateType>::kRawBytes>());
+    }
+    // States with serialize() are hashed by their encoding, which unlike
+    // absl::Hash is the same in every process, so their checkpoints can be
+    // resumed.
+    static Fingerprint hashEncoded(const StateType& s, std::true_type) {
+        static thread_local std::string encoded;
+        encoded.clear();
+        StateCodec<StateType>::encode(s, encoded);
+        return hashBytes(encoded.data(), encoded.size());
+    }
+    // The padding of the rest is arbitrary, so they are hashed by field.
+    static Fingerprint hashEncoded(const StateType& s, std::false_type) {
+#ifdef CHECKER_FINGERPRINT_128
+        // absl::Hash gives 64 bits; the second half hashes the state salted.
+        return Fingerprint(absl::Hash<StateType>{}(s)) << 64 | absl::Hash<Salted>{}(Salted{s});
+#else
+        return absl::Hash<StateType>{}(s);
+#endif
+    }
+    struct Salted {
+        const StateType& state;
+        template <typename H>
+        friend H AbslHashValue(H h, const Salted& s) {
+            return H::combine(std::move(h), uint64_t(0x2545f4914f6cdd1dull), s.state);
+        }
+    };
+    static bool equal(const StateType& lhs, const StateType& rhs, std::true_type) {
+        return memcmp(&lhs, &rhs, sizeof(StateType)) == 0;
+    }
+    static bool equal(const StateType& lhs, const StateType& rhs, std::false_type) {
+        return lhs == rhs;
+    }
+
+    template <class F>
+    void emit(F& fun) {
+        nesting++;
+        fun();
+        nesting--;
+        Checker<StateType>::get()->onNewState(getState());
+    }
+
+    StateType& getState() { return *static_cast<StateType*>(this); }
+
+    // What the outermost either() on this thread restores.
+    StateType& savedState() {
+        static thread_local std::unique_ptr<StateType> saved;
+        if (!saved) {
+            saved.reset(new StateType(getState()));
+        }
+        return *saved;
+    }
+
+    // Depth of either() calls on this thread.
+    static thread_local int nesting;
+};
+
+template <class StateType>
+thread_local int ModelState<StateType>::nesting = 0;
+
+class InvariantViolatedException : public std::exception {};
+
+template <class StateType>
+void Checker<StateType>::run(std::vector<StateType> initialStates, CheckerOptions options) {
+    bool checkpointing = !options.checkpointPath.empty() || !options.resumePath.empty();
+    if (checkpointing && options.search != SearchStrategy::BreadthFirst) {
+        std::cerr << "Only breadth-first searches take checkpoints and resume." << std::endl;
+        return;
+    }
+    if (options.scheduler == Scheduler::Levels && options.partialOrder) {
+        std::cerr << "--scheduler=levels does not run with --por." << std::endl;
+        return;
+    }
+    if (options.processes > 1 && (options.search != SearchStrategy::BreadthFirst || options.partialOrder
+            || options.seenBackend == SeenBackend::Bitstate || checkpointing || options.deterministic)) {
+        std::cerr << "--processes runs a breadth-first search with --seen=memory or disk, "
+                  << "without --por, checkpoints or --deterministic." << std::endl;
+        return;
+    }
+    size_t workers = options.workers;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (options.deterministic && options.search == SearchStrategy::BreadthFirst && workers > 1) {
+        // The cycle proviso of --por depends on the order states are expanded in.
+        if (options.partialOrder) {
+            workers = 1;
+        } else {
+            options.scheduler = Scheduler::Levels;
+        }
+    }
+    _unvisited.reset(options.diskDirectory, options.queueMemory);
+    // Without parent links there is no trace to keep states for.
+    _keepStates = options.keepStates && options.seenBackend != SeenBackend::Bitstate;
+    _partialOrder = options.partialOrder;
+    _depthBound = options.maxDepth == 0 ? UINT32_MAX : options.maxDepth;
+    _depthFirst = options.search != SearchStrategy::BreadthFirst;
+    _trackDepths = _depthFirst && (options.maxDepth != 0 || options.search == SearchStrategy::IterativeDeepening);
+    if (!_keepStates) {
+        _initialStates = initialStates;
+    }
+    _stopped = false;
+    _violated = false;
+    _stats.reset();
+    _clusterStats.reset();
+    _remoteSeen = 0;
+    _seenPastViolation = 0;
+    // The other processes start here, before any thread does.
+    _mesh.reset(options.processes > 1 ? new ProcessMesh(options.processes) : nullptr);
+    bool reporting = !_mesh || _mesh->rank() == 0;
+    resetTables(options, initialStates.size());
+    _checkpointPath = options.checkpointPath;
+    _checkpointDue = false;
+    if (checkpointing) {
+        _checkpointHeader = checkpointHeader(initialStates, options);
+    }
+    if (!options.resumePath.empty()) {
+        readCheckpoint(options.resumePath);
+    }
+
+    Reporter reporter(_mesh ? _clusterStats : _stats, options.reportFormat);
+    PeriodicTask progress(reporting ? options.reportInterval : 0, [&]() { reporter.report(); });
+    PeriodicTask checkpoints(_checkpointPath.empty() ? 0 : options.checkpointInterval,
+                             [this]() { _checkpointDue = true; });
+    _checkpointTimer = &checkpoints;
+
+    try {
+        if (options.search == SearchStrategy::Simulation) {
+            simulate(initialStates, options, workers);
+        } else if (options.search == SearchStrategy::Swarm) {
+            swarm(initialStates, options, workers);
+        } else if (_depthFirst) {
+            searchDepthFirst(initialStates, options);
+        } else if (_mesh) {
+            exploreDistributed(initialStates, options);
+        } else if (workers == 1) {
+            if (options.resumePath.empty()) {
+                checkStates(initialStates.data(), initialStates.size(), 0, 0);
+            }
+            _stats.queued = _unvisited.size();
+            while (!_unvisited.empty()) {
+                exploreBatch();
+                _stats.queued = _unvisited.size();
+                if (needsGrow()) {
+                    grow();
+                }
+                if (_checkpointDue) {
+                    writeCheckpoint();
+                }
+            }
+        } else if (options.scheduler == Scheduler::Levels) {
+            if (options.resumePath.empty()) {
+                checkStates(initialStates.data(), initialStates.size(), 0, 0);
+            }
+            exploreLevels(workers);
+        } else {
+            if (options.resumePath.empty()) {
+                checkStates(initialStates.data(), initialStates.size(), 0, 0);
+            }
+            _stats.queued = _unvisited.size();
+            bool stealing = options.scheduler == Scheduler::Stealing;
+            _deques.clear();
+            for (size_t i = 0; stealing && i < workers; i++) {
+                _deques.emplace_back(new WorkerDeque<QueuedState<StateType>>);
+            }
+            _dequeStates = 0;
+            _idleWorkers = 0;
+            _searchDone = false;
+            _layered = stealing && (options.layered || options.maxDepth != 0);
+            _layer = _unvisited.empty() ? 0 : _unvisited.front().depth;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < workers; i++) {
+                threads.emplace_back([this, i, stealing]() {
+                    if (stealing) {
+                        runStealingWorker(i);
+                    } else {
+                        runWorker();
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            _deques.clear();
+        }
+    } catch (InvariantViolatedException& exp) {}
+    _checkpointTimer = nullptr;
+
+    if (!reporting) {
+        // Rank 0 reports for every process.
+        std::cout << std::flush;
+        _exit(0);
+    }
+    if (options.reportFormat == ReportFormat::Json) {
+        // A last record so the totals can be read from the stream alone.
+        _stats.queued = _unvisited.size() + _dequeStates;
+        reporter.report();
+    }
+    std::cout << "Model checking finished." << std::endl << getStats() << std::endl;
+    if (!_seenStates->report().empty()) {
+        std::cout << _seenStates->report() << std::endl;
+    }
+    // Only a search that ran to the end has seen every state it could have
+    // merged with another.
+    bool exhaustive = options.search != SearchStrategy::Simulation && options.search != SearchStrategy::Swarm
+        && !_violated;
+    if (exhaustive && _seenStates->keepsParents() && _stats.unique > 1) {
+        // The birthday bound: each pair of the n distinct states shares a
+        // fingerprint with probability 2^-bits, which would silently merge them.
+        long double n = _stats.unique.load();
+        long double p = std::ldexp(n * (n - 1) / 2, -kFingerprintBits);
+        std::cout << "Fingerprint collision probability: " << double(std::min<long double>(p, 1))
+                  << " (" << kFingerprintBits << "-bit fingerprints)." << std::endl;
+    }
+    _mesh.reset();
+}
+
+template <class StateType>
+void Checker<StateType>::resetTables(const CheckerOptions& options, size_t initialStates) {
+    size_t capacity = std::max({options.seenCapacity, initialStates * 2, kMinTableSlots});
+    auto newFingerprintSet = [&]() -> FingerprintSet* {
+        if (options.seenBackend == SeenBackend::Disk) {
+            return new DiskFingerprintSet(options.diskDirectory, options.seenCapacity);
+        }
+        if (options.seenBackend == SeenBackend::Bitstate) {
+            return new BitstateFingerprintSet(options.bitstateBytes, options.bitstateHashes);
+        }
+        return new ConcurrentFingerprintSet(capacity);
+    };
+    _seenStates.reset(newFingerprintSet());
+    _expandedStates.reset(_partialOrder ? newFingerprintSet() : nullptr);
+    if (_keepStates) {
+        _traceStates.reset(capacity);
+    }
+    if (_trackDepths) {
+        _depths.reset();
+    }
+    _stats.seenBytes = _seenStates->memoryBytes() + (_keepStates ? _traceStates.memoryBytes() : 0);
+}
+
+template <class StateType>
+void Checker<StateType>::searchDepthFirst(const std::vector<StateType>& initialStates,
+                                          const CheckerOptions& options) {
+    uint32_t maxDepth = _depthBound;
+    if (options.search == SearchStrategy::IterativeDeepening) {
+        _depthBound = std::min(options.depthStep, maxDepth);
+    }
+    while (true) {
+        if (options.search == SearchStrategy::IterativeDeepening) {
+            std::cout << "Exploring to depth " << _depthBound << "." << std::endl;
+        }
+        _cutOff = false;
+        _stack.clear();
+        checkStates(initialStates.data(), initialStates.size(), 0, 0);
+        while (!_stack.empty()) {
+            auto cur = std::move(_stack.back());
+            _stack.pop_back();
+            if (cur.depth > _stats.depth.load(std::memory_order_relaxed)) {
+                _stats.depth = cur.depth;
+            }
+            explore(cur);
+            _stats.queued = _stack.size();
+            if (needsGrow()) {
+                grow();
+            }
+        }
+        // A round that was cut short nowhere has seen the whole state space.
+        if (options.search != SearchStrategy::IterativeDeepening || !_cutOff || _depthBound >= maxDepth) {
+            break;
+        }
+        _depthBound = maxDepth - _depthBound > options.depthStep ? _depthBound + options.depthStep : maxDepth;
+        // Each round starts over, so the stats describe the last one.
+        _stats.reset();
+        resetTables(options, initialStates.size());
+    }
+}
+
+template <class StateType>
+void Checker<StateType>::simulate(const std::vector<StateType>& initialStates,
+                                  const CheckerOptions& options, size_t workers) {
+    if (initialStates.empty()) {
+        // There is nowhere to start a walk, as there is no state to search.
+        return;
+    }
+    uint64_t seed = pickSeed(options.seed);
+    uint32_t length = options.maxDepth == 0 ? 100 : options.maxDepth;
+    std::cout << "Simulating " << options.walks << " walks of up to " << length
+              << " steps with --seed=" << seed << "." << std::endl;
+
+    uint64_t walks = runTasks(options.walks, workers, kWalksPerRound, options.deterministic,
+                              [&](uint64_t walk, TaskTally& tally) {
+        static thread_local StateBuffer<StateType> successors;
+        static thread_local std::vector<StateType> path;
+        WalkRandom random(seed, walk);
+        path.assign(1, initialStates[random.below(initialStates.size())]);
+        while (true) {
+            _stats.generated++;
+            tally.generated++;
+            if (!path.back().satisfyInvariant()) {
+                tally.trace = path;
+                return;
+            }
+            if (path.size() > length || !path.back().satisfyConstraint()) break;
+            generateSuccessors(path.back(), successors);
+            // The last successor is the unchanged state.
+            size_t n = successors.size() - 1;
+            if (n == 0) break;
+            path.push_back(successors.data()[random.below(n)]);
+        }
+        tally.depth = path.size() - 1;
+        noteDepth(tally.depth);
+    });
+    std::cout << "Simulated " << walks << " walks." << std::endl;
+    if (_violated) {
+        throw InvariantViolatedException();
+    }
+}
+
+template <class StateType>
+void Checker<StateType>::swarm(const std::vector<StateType>& initialStates,
+                               const CheckerOptions& options, size_t workers) {
+    uint64_t seed = pickSeed(options.seed);
+    std::cout << "Running a swarm of " << options.searches << " searches to depth "
+              << (options.maxDepth == 0 ? 100 : options.maxDepth) << " with --seed=" << seed << "." << std::endl;
+
+    uint64_t searches = runTasks(options.searches, workers, 1, options.deterministic,
+                                 [&](uint64_t search, TaskTally& tally) {
+        swarmSearch(initialStates, options, seed, search, tally);
+    });
+    std::cout << "Ran " << searches << " searches." << std::endl;
+    if (_violated) {
+        throw InvariantViolatedException();
+    }
+}
+
+// Runs task(i, tally) for the walks or searches i < n on the workers, and
+// reports the first violation found. Returns how many ran. The tasks keep
+// the counters up to date for progress reports as they go.
+//
+// A deterministic run takes the tasks in rounds of perWorker per worker and
+// goes through each round in order once it is done. The first task with a
+// violation reports it, and the counters are set from the tallies of the
+// tasks up to it, so neither depends on the number of workers or their
+// timing. The tasks after it in its round run for nothing.
+template <class StateType>
+template <class F>
+uint64_t Checker<StateType>::runTasks(uint64_t n, size_t workers, size_t perWorker, bool deterministic, F&& task) {
+    if (!deterministic) {
+        std::atomic<uint64_t> next{0};
+        parallelFor(workers, workers, [&](size_t) {
+            try {
+                for (uint64_t i; !_stopped && (i = next++) < n;) {
+                    TaskTally tally;
+                    task(i, tally);
+                    if (!tally.trace.empty()) {
+                        reportViolation(tally.trace);
+                    }
+                }
+            } catch (InvariantViolatedException& exp) {
+                _stopped = true;
+            }
+        });
+        return std::min(next.load(), n);
+    }
+
+    uint64_t ran = 0, generated = 0, unique = 0, depth = 0;
+    std::vector<TaskTally> tallies;
+    const TaskTally* violation = nullptr;
+    for (uint64_t first = 0; first < n && !violation; first += tallies.size()) {
+        tallies.assign(std::min<uint64_t>(n - first, workers * perWorker), TaskTally());
+        parallelFor(workers, tallies.size(), [&](size_t i) { task(first + i, tallies[i]); });
+        for (auto& tally : tallies) {
+            ran++;
+            generated += tally.generated;
+            unique += tally.unique;
+            depth = std::max(depth, tally.depth);
+            if (!tally.trace.empty()) {
+                violation = &tally;
+                break;
+            }
+        }
+    }
+    _stats.generated = generated;
+    _stats.unique = unique;
+    _stats.depth = depth;
+    if (violation) {
+        try {
+            reportViolation(violation->trace);
+        } catch (InvariantViolatedException& exp) {
+            _stopped = true;
+        }
+    }
+    return ran;
+}
+
+template <class StateType>
+void Checker<StateType>::swarmSearch(const std::vector<StateType>& initialStates, const CheckerOptions& options,
+                                     uint64_t seed, uint64_t search, TaskTally& tally) {
+    WalkRandom random(seed, search);
+    uint64_t hashSeed = random.next();
+    BitstateTable seen(options.bitstateBytes, options.bitstateHashes);
+    uint32_t bound = options.maxDepth == 0 ? 100 : options.maxDepth;
+
+    // The DFS path, each state with its successors in random order.
+    struct Frame {
+        StateType state;
+        std::vector<StateType> successors;
+        size_t next;
+    };
+    std::vector<Frame> frames;
+    size_t depth = 0;
+    StateBuffer<StateType> generated;
+
+    auto visit = [&](const StateType& state) {
+        _stats.generated++;
+        tally.generated++;
+        // Rehashing with the seed of this search makes its collisions differ from the others'.
+        if (!seen.insert(WalkRandom(hashSeed, foldFingerprint(state.hash())).next())) return;
+        _stats.unique++;
+        tally.unique++;
+        if (!state.satisfyInvariant()) {
+            for (size_t i = 0; i < depth; i++) {
+                tally.trace.push_back(frames[i].state);
+            }
+            tally.trace.push_back(state);
+            return;
+        }
+        if (depth >= bound || !state.satisfyConstraint()) return;
+
+        if (frames.size() == depth) frames.emplace_back();
+        Frame& frame = frames[depth++];
+        frame.state = state;
+        generateSuccessors(state, generated);
+        // Leave out the last successor, the unchanged state.
+        frame.successors.assign(generated.begin(), generated.end() - 1);
+        for (size_t i = frame.successors.size(); i > 1; i--) {
+            std::swap(frame.successors[i - 1], frame.successors[random.below(i)]);
+        }
+        frame.next = 0;
+        tally.depth = std::max<uint64_t>(tally.depth, depth);
+        noteDepth(depth);
+    };
+
+    std::vector<StateType> initial = initialStates;
+    for (size_t i = initial.size(); i > 1; i--) {
+        std::swap(initial[i - 1], initial[random.below(i)]);
+    }
+    for (size_t i = 0; i < initial.size() && tally.trace.empty(); i++) {
+        visit(initial[i]);
+        while (depth > 0 && !_stopped && tally.trace.empty()) {
+            Frame& frame = frames[depth - 1];
+            if (frame.next == frame.successors.size()) {
+                depth--;
+                continue;
+            }
+            // visit() may grow frames, so copy the state out of it first.
+            StateType next = frame.successors[frame.next++];
+            visit(next);
+        }
+    }
+}
+
+template <class StateType>
+void Checker<StateType>::reportViolation(const std::vector<StateType>& errorTrace, const char* note) {
+    // Other workers may hit violations before they notice the search has stopped.
+    if (_violated.exchange(true)) {
+        throw InvariantViolatedException();
+    }
+    std::cout << "Violated invariant." << std::endl;
+    for (size_t i = 0; i < errorTrace.size(); i++) {
+        std::cout << "State: " << i << std::endl << errorTrace[i] << std::endl << std::endl;
+    }
+    if (note) {
+        std::cout << note << std::endl;
+    }
+    throw InvariantViolatedException();
+}
+
+template <class StateType>
+void Checker<StateType>::explore(const QueuedState<StateType>& cur) {
+    static thread_local StateBuffer<StateType> successors;
+    static thread_local std::vector<ActionRecord> actions;
+    generatedActions = _partialOrder ? &actions : nullptr;
+    actions.clear();
+    generateSuccessors(cur.state, successors);
+    generatedActions = nullptr;
+
+    Fingerprint parent = cur.state.hash();
+    if (!_partialOrder) {
+        checkStates(successors.data(), successors.size(), parent, cur.depth + 1);
+        return;
+    }
+    _expandedStates->insert(parent, 0);
+    // Pairs with the same fence of a worker expanding another state of a
+    // cycle, so that at least one of them sees the other as expanded.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Successors outside action(), except the last unchanged state, are
+    // treated as actions that depend on everything.
+    size_t covered = 0, last = successors.size() - 1;
+    for (size_t i = 0, n = actions.size(); i <= n; i++) {
+        size_t begin = i < n ? actions[i].begin : last;
+        if (covered < begin) {
+            actions.push_back(ActionRecord{{~uint64_t(0), ~uint64_t(0)}, true, covered, begin});
+        }
+        if (i < n) covered = actions[i].end;
+    }
+
+    static thread_local std::vector<bool> subset;
+    static thread_local StateBuffer<StateType> reduced;
+    bool reduce = persistentSubset(actions, VisibleVariables<StateType>::value, &subset);
+    if (reduce) {
+        reduced.clear();
+        for (size_t i = 0; i < actions.size() && reduce; i++) {
+            if (!subset[i]) continue;
+            for (size_t j = actions[i].begin; j < actions[i].end && reduce; j++) {
+                // The cycle proviso: a successor whose expansion has started
+                // may close a cycle, so the state is expanded fully.
+                Fingerprint fp = successors.data()[j].hash(), unused;
+                reduce = fp != parent && !_expandedStates->find(fp, &unused);
+                reduced.push_back(successors.data()[j]);
+            }
+        }
+    }
+    if (!reduce) {
+        checkStates(successors.data(), successors.size(), parent, cur.depth + 1);
+        return;
+    }
+    reduced.push_back(successors.data()[last]);
+    checkStates(reduced.data(), reduced.size(), parent, cur.depth + 1);
+}
+
+// Expands states of one depth from the front of the queue until their
+// successors fill a batch, and checks the batch at once, so the seen set
+// probes for all of them together rather than a few at a time. Partial-order
+// reduction decides per state, so it expands one state.
+template <class StateType>
+void Checker<StateType>::exploreBatch() {
+    if (_partialOrder) {
+        explore(popUnvisited());
+        return;
+    }
+    static thread_local StateBuffer<StateType> successors;
+    static thread_local std::vector<Fingerprint> parents;
+    successors.clear();
+    parents.clear();
+    // Like the levels scheduler, stay within what the seen set can take
+    // before it grows.
+    size_t room = std::min(kBatchSuccessors, std::max<size_t>(8, _seenStates->size()));
+    uint32_t depth = _unvisited.front().depth;
+    while (successors.size() < room && !_unvisited.empty() && _unvisited.front().depth == depth) {
+        auto cur = popUnvisited();
+        appendSuccessors(cur.state, successors);
+        parents.resize(successors.size(), cur.state.hash());
+    }
+    checkBatch(successors.data(), successors.size(), parents.data(), depth + 1);
+}
+
+template <class StateType>
+QueuedState<StateType> Checker<StateType>::popUnvisited() {
+    auto cur = _unvisited.pop();
+    noteDepth(cur.depth);
+    return cur;
+}
+
+template <class StateType>
+void Checker<StateType>::noteDepth(uint32_t depth) {
+    uint64_t deepest = _stats.depth.load(std::memory_order_relaxed);
+    while (depth > deepest && !_stats.depth.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {}
+}
+
+template <class StateType>
+void Checker<StateType>::generateSuccessors(const StateType& curState,
+                                            StateBuffer<StateType>& successors) const {
+    successors.clear();
+    appendSuccessors(curState, successors);
+}
+
+// The successors of curState, after those already in successors.
+template <class StateType>
+void Checker<StateType>::appendSuccessors(const StateType& curState,
+                                          StateBuffer<StateType>& successors) const {
+    generatedStates = &successors;
+    // Create the new state.
+    auto newState = curState;
+    newState.generate();
+    successors.push_back(newState);
+    generatedStates = nullptr;
+}
+
+template <class StateType>
+void Checker<StateType>::runWorker() {
+    std::vector<QueuedState<StateType>> successors;
+    localSuccessors = &successors;
+
+    std::unique_lock<std::mutex> lk(_unvisitedMutex);
+    while (true) {
+        // The search is over once nothing is queued and no worker can queue more.
+        _unvisitedCv.wait(lk, [&]() {
+            return _stopped || (!_pausing && (!_unvisited.empty() || _busyWorkers == 0));
+        });
+        if (_stopped || _unvisited.empty()) break;
+
+        auto cur = popUnvisited();
+        _busyWorkers++;
+        lk.unlock();
+
+        try {
+            explore(cur);
+        } catch (InvariantViolatedException& exp) {
+            _stopped = true;
+        }
+
+        lk.lock();
+        _busyWorkers--;
+        for (auto& s : successors) {
+            _unvisited.push(std::move(s));
+        }
+        _stats.queued = _unvisited.size();
+
+        // Inserts are lock-free but growing is not, and a checkpoint needs
+        // every table at rest: stop handing out states and pause once every
+        // other worker is done with its current expansion.
+        bool paused = false;
+        if (!_pausing && (needsGrow() || _checkpointDue)) {
+            _pausing = true;
+            _unvisitedCv.wait(lk, [&]() { return _busyWorkers == 0; });
+            if (needsGrow()) {
+                grow();
+            }
+            if (_checkpointDue && !_stopped) {
+                writeCheckpoint();
+            }
+            _pausing = false;
+            paused = true;
+        }
+
+        if (_stopped || paused || successors.size() > 1 || _busyWorkers == 0) {
+            _unvisitedCv.notify_all();
+        } else if (!successors.empty()) {
+            _unvisitedCv.notify_one();
+        }
+        successors.clear();
+    }
+    lk.unlock();
+    localSuccessors = nullptr;
+}
+
+// With the work-stealing scheduler, a worker explores states from its own
+// deque in small batches, newest first. Once the deque runs dry it takes a
+// batch from the shared queue, then tries to steal from the other workers,
+// and only then waits. With --layered, successors belong to the next level:
+// they are gathered in next and moved to the shared queue in batches, behind
+// the states of the current level.
+template <class StateType>
+void Checker<StateType>::runStealingWorker(size_t id) {
+    std::vector<QueuedState<StateType>> successors, batch, next;
+    localSuccessors = &successors;
+    auto& own = *_deques[id];
+    size_t victim = (id + 1) % _deques.size();
+
+    while (!_stopped) {
+        if (_pausing || needsGrow() || (_checkpointDue && !_layered)) {
+            // A checkpoint saves the deques, so put the batch back first.
+            _dequeStates += batch.size();
+            own.push(batch);
+            pauseWorkers();
+            continue;
+        }
+        if (batch.empty()) {
+            own.popBack(kWorkerBatch, batch);
+            _dequeStates -= batch.size();
+        }
+        if (batch.empty()) {
+            if (!next.empty()) {
+                publish(next);
+            }
+            if (!takeShared(own, batch) && !steal(id, victim, own, batch) && !awaitWork()) break;
+            continue;
+        }
+
+        auto cur = std::move(batch.back());
+        batch.pop_back();
+        noteDepth(cur.depth);
+        try {
+            explore(cur);
+        } catch (InvariantViolatedException& exp) {
+            _stopped = true;
+        }
+
+        if (_layered) {
+            std::move(successors.begin(), successors.end(), std::back_inserter(next));
+            if (next.size() >= kPublishStates) {
+                publish(next);
+            }
+        } else if (!successors.empty()) {
+            _dequeStates += successors.size();
+            own.push(successors);
+            if (own.size() > kDequeStates) {
+                // Keep the newest half, and let the shared queue spill the rest.
+                own.popFront(kDequeStates / 2, next);
+                _dequeStates -= next.size();
+                publish(next);
+            } else if (_idleWorkers > 0) {
+                std::lock_guard<std::mutex> lk(_unvisitedMutex);
+                _wakeups++;
+                _unvisitedCv.notify_all();
+            }
+        }
+        successors.clear();
+    }
+
+    std::lock_guard<std::mutex> lk(_unvisitedMutex);
+    // A worker that has stopped counts as idle for one that is pausing.
+    _idleWorkers++;
+    _unvisitedCv.notify_all();
+    localSuccessors = nullptr;
+}
 
-private:
-    struct Stats {
-        uint64_t generated = 0;
-        uint64_t unique = 0;
-        friend std::ostream& operator << (std::ostream &out, const Stats& s) {
-            return out << "generated: " << s.generated << " unique: " << s.unique;
+// Moves a batch from the shared queue to the worker's deque; with
+// --layered, only states of the current level.
+template <class StateType>
+bool Checker<StateType>::takeShared(WorkerDeque<QueuedState<StateType>>& own,
+                                    std::vector<QueuedState<StateType>>& taken) {
+    {
+        std::lock_guard<std::mutex> lk(_unvisitedMutex);
+        while (taken.size() < kSharedBatch && !_unvisited.empty()
+               && (!_layered || _unvisited.front().depth <= _layer)) {
+            taken.push_back(_unvisited.pop());
         }
-    };
-    static Checker<StateType>* globalChecker;
-    std::vector<StateType> trace(const StateType& endState) const;
-
-    std::unordered_map<Fingerprint, StateType> _seenStates;
-    std::queue<StateType> _unvisited;
-    Stats _stats;
-};
+        if (taken.empty()) return false;
+        _dequeStates += taken.size();
+        _stats.queued = _unvisited.size() + _dequeStates;
+    }
+    own.push(taken);
+    return true;
+}
 
+// Steals from the other workers in turn, starting with the last victim.
 template <class StateType>
-Checker<StateType>* Checker<StateType>::globalChecker = new Checker<StateType>;
+bool Checker<StateType>::steal(size_t id, size_t& victim, WorkerDeque<QueuedState<StateType>>& own,
+                               std::vector<QueuedState<StateType>>& taken) {
+    for (size_t i = 0; i < _deques.size() && _dequeStates > 0; i++) {
+        size_t v = (victim + i) % _deques.size();
+        if (v == id) continue;
+        _deques[v]->steal(taken);
+        if (!taken.empty()) {
+            victim = v;
+            own.push(taken);
+            return true;
+        }
+    }
+    return false;
+}
 
 template <class StateType>
-struct ModelState {
-    Fingerprint prevHash = 0;
-    Fingerprint hash() const {
-        return absl::Hash<StateType>{}(*static_cast<const StateType*>(this));
+void Checker<StateType>::publish(std::vector<QueuedState<StateType>>& states) {
+    std::lock_guard<std::mutex> lk(_unvisitedMutex);
+    for (auto& s : states) {
+        _unvisited.push(std::move(s));
     }
-protected:
-    void either(const std::function<void()>& fun) {
-        // Generate states on a copy of the current state.
-        StateType temp = getState();
-        fun();
-        Checker<StateType>::get()->onNewState(getState());
-        getState() = temp;
+    states.clear();
+    _stats.queued = _unvisited.size() + _dequeStates;
+    if (!_layered && _idleWorkers > 0) {
+        _wakeups++;
+        _unvisitedCv.notify_all();
     }
+}
 
-private:
-    StateType& getState() { return *static_cast<StateType*>(this); }
-};
+// Waits until there may be states to take. Returns false once the search is
+// over: every worker is idle and no state is left, or with --layered, left
+// in the current level. Then the last one to go idle starts the next level,
+// first growing the tables or writing a checkpoint if needed.
+template <class StateType>
+bool Checker<StateType>::awaitWork() {
+    std::unique_lock<std::mutex> lk(_unvisitedMutex);
+    _idleWorkers++;
+    while (!_stopped && !_searchDone) {
+        bool shared = !_unvisited.empty() && (!_layered || _unvisited.front().depth <= _layer);
+        if (!_pausing && (shared || _dequeStates > 0)) {
+            _idleWorkers--;
+            return true;
+        }
+        if (!_pausing && _idleWorkers == _deques.size()) {
+            if (!_layered || _unvisited.empty()) {
+                _searchDone = true;
+                break;
+            }
+            if (needsGrow()) {
+                grow();
+            }
+            if (_checkpointDue) {
+                writeCheckpoint();
+            }
+            _layer = _unvisited.front().depth;
+            _wakeups++;
+            _unvisitedCv.notify_all();
+            _idleWorkers--;
+            return true;
+        }
+        if (_pausing) {
+            _unvisitedCv.notify_all();
+        }
+        uint64_t wakeups = _wakeups;
+        _unvisitedCv.wait(lk, [&]() { return _stopped || _searchDone || _wakeups != wakeups; });
+    }
+    _idleWorkers--;
+    _unvisitedCv.notify_all();
+    return false;
+}
 
-class InvariantViolatedException : public std::exception {};
+// Called between expansions. Inserts are lock-free but growing is not, and
+// a checkpoint needs every table at rest, so the worker that sees the need
+// waits until every other worker is idle or waiting here as well.
+template <class StateType>
+void Checker<StateType>::pauseWorkers() {
+    std::unique_lock<std::mutex> lk(_unvisitedMutex);
+    if (_pausing) {
+        _idleWorkers++;
+        _unvisitedCv.notify_all();
+        _unvisitedCv.wait(lk, [&]() { return _stopped || !_pausing; });
+        _idleWorkers--;
+        return;
+    }
+    if (!needsGrow() && !(_checkpointDue && !_layered)) return;
+    _pausing = true;
+    _unvisitedCv.wait(lk, [&]() { return _stopped || _idleWorkers + 1 == _deques.size(); });
+    if (!_stopped) {
+        if (needsGrow()) {
+            grow();
+        }
+        if (_checkpointDue && !_layered) {
+            // Checkpoints keep only the shared queue.
+            std::vector<QueuedState<StateType>> states;
+            for (auto& deque : _deques) {
+                deque->popFront(SIZE_MAX, states);
+            }
+            for (auto& s : states) {
+                _unvisited.push(std::move(s));
+            }
+            _dequeStates = 0;
+            writeCheckpoint();
+        }
+    }
+    _pausing = false;
+    _wakeups++;
+    _unvisitedCv.notify_all();
+}
 
+// Runs task(i) for every i < n on up to workers threads, the calling one
+// among them, each taking the next i once it is done with the last.
 template <class StateType>
-void Checker<StateType>::run(std::vector<StateType> initialStates) {
-    try {
-        for (auto& s : initialStates) {
-            onNewState(s);
+template <class F>
+void Checker<StateType>::parallelFor(size_t workers, size_t n, F&& task) {
+    std::atomic<size_t> next{0};
+    auto run = [&]() {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;) {
+            task(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(workers, n); i++) {
+        threads.emplace_back(run);
+    }
+    run();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+// With --scheduler=levels, the queue is explored in rounds, each made of the
+// oldest states up to the end of their level. A round takes two steps with
+// the workers in between:
+//  1. Expand: the round is cut into chunks of consecutive states, which the
+//     workers expand and fingerprint. Each chunk sorts its successors by the
+//     worker owning their fingerprint, keeping their order.
+//  2. Insert: every worker inserts the successors it owns, chunk by chunk,
+//     into the seen set. All occurrences of a fingerprint go to the same
+//     worker in BFS order, so the first one is inserted, with its parent, as
+//     it would be by one worker. The new states are checked there too.
+// The main thread then queues the new states in BFS order. Inserts run in
+// slices of chunks, growing the tables in between: both hash tables grow
+// once half full, so a slice has room for as many successors as they hold.
+template <class StateType>
+void Checker<StateType>::exploreLevels(size_t workers) {
+    struct Chunk {
+        // The successors of the states of the chunk, in order, with their
+        // fingerprints, those of their parents and the parents' place in
+        // the round.
+        std::vector<const StateType*> states;
+        std::vector<Fingerprint> fps;
+        std::vector<Fingerprint> parents;
+        std::vector<uint32_t> from;
+        // The positions of the successors each worker owns.
+        std::vector<std::vector<uint32_t>> owned;
+        // For each successor: 0 if seen before, 1 if new and to be
+        // explored, 2 if new and not.
+        std::vector<uint8_t> status;
+    };
+    // The position of the first violating state in BFS order so far.
+    struct Violation {
+        size_t chunk = SIZE_MAX;
+        size_t position = 0;
+        // Whether successor p of chunk c comes first.
+        bool after(size_t c, size_t p) const { return c < chunk || (c == chunk && p < position); }
+    };
+
+    std::vector<QueuedState<StateType>> round;
+    std::vector<StateBuffer<StateType>> successors;
+    std::vector<Chunk> chunks;
+    Violation violation;
+    std::mutex violationMutex;
+    // A Bloom filter's answers depend on the order of the inserts, so they
+    // stay in BFS order on one worker.
+    size_t inserters = _seenStates->keepsParents() ? workers : 1;
+    while (!_unvisited.empty()) {
+        uint32_t depth = _unvisited.front().depth;
+        round.clear();
+        while (round.size() < kRoundStates && !_unvisited.empty() && _unvisited.front().depth == depth) {
+            round.push_back(_unvisited.pop());
+        }
+        noteDepth(depth);
+        uint64_t generatedBefore = _stats.generated, uniqueBefore = _stats.unique;
+        if (successors.size() < round.size()) {
+            successors.resize(round.size());
+        }
+        // Small chunks early on, so that a few states still keep every worker busy.
+        size_t chunkStates = std::max<size_t>(1, std::min<size_t>(64, round.size() / (workers * 8)));
+        size_t nChunks = (round.size() + chunkStates - 1) / chunkStates;
+        if (chunks.size() < nChunks) {
+            chunks.resize(nChunks);
         }
 
-        while (!_unvisited.empty()) {
-            auto curState = _unvisited.front();
-            _unvisited.pop();
+        parallelFor(workers, nChunks, [&](size_t c) {
+            Chunk& chunk = chunks[c];
+            chunk.states.clear();
+            chunk.fps.clear();
+            chunk.parents.clear();
+            chunk.from.clear();
+            chunk.owned.resize(inserters);
+            for (auto& owned : chunk.owned) {
+                owned.clear();
+            }
+            size_t end = std::min(round.size(), (c + 1) * chunkStates);
+            for (size_t i = c * chunkStates; i < end; i++) {
+                generateSuccessors(round[i].state, successors[i]);
+                Fingerprint parent = round[i].state.hash();
+                for (auto& next : successors[i]) {
+                    Fingerprint fp = next.hash();
+                    chunk.owned[foldFingerprint(fp) % inserters].push_back(chunk.states.size());
+                    chunk.states.push_back(&next);
+                    chunk.fps.push_back(fp);
+                    chunk.parents.push_back(parent);
+                    chunk.from.push_back(i);
+                }
+            }
+            chunk.status.assign(chunk.states.size(), 0);
+        });
 
-            // Create the new state.
-            auto newState = curState;
-            newState.prevHash = curState.hash();
-            newState.generate();
-            onNewState(newState);
+        for (size_t first = 0; first < nChunks && violation.chunk == SIZE_MAX;) {
+            size_t last = first, room = std::max<size_t>(8, _seenStates->size());
+            for (size_t n = 0; last < nChunks && (last == first || n + chunks[last].states.size() <= room); last++) {
+                n += chunks[last].states.size();
+            }
+            parallelFor(inserters, inserters, [&](size_t w) {
+                static thread_local std::vector<Fingerprint> fps, parents;
+                static thread_local std::vector<std::pair<uint32_t, uint32_t>> where;
+                static thread_local std::unique_ptr<bool[]> inserted;
+                static thread_local size_t insertedCapacity = 0;
+                fps.clear();
+                parents.clear();
+                where.clear();
+                for (size_t c = first; c < last; c++) {
+                    for (uint32_t p : chunks[c].owned[w]) {
+                        fps.push_back(chunks[c].fps[p]);
+                        parents.push_back(chunks[c].parents[p]);
+                        where.emplace_back(c, p);
+                    }
+                }
+                if (insertedCapacity < fps.size()) {
+                    inserted.reset(new bool[fps.size()]);
+                    insertedCapacity = fps.size();
+                }
+                _seenStates->insertBatch(fps.size(), fps.data(), parents.data(), inserted.get());
+                Violation found;
+                for (size_t i = 0; i < fps.size(); i++) {
+                    if (!inserted[i]) continue;
+                    Chunk& chunk = chunks[where[i].first];
+                    const StateType& state = *chunk.states[where[i].second];
+                    _stats.unique++;
+                    if (_keepStates) {
+                        _traceStates.insert(fps[i], state);
+                    }
+                    if (!state.satisfyInvariant()) {
+                        if (found.after(where[i].first, where[i].second)) {
+                            found.chunk = where[i].first;
+                            found.position = where[i].second;
+                        }
+                        chunk.status[where[i].second] = 2;
+                    } else {
+                        chunk.status[where[i].second] = state.satisfyConstraint() ? 1 : 2;
+                    }
+                }
+                if (found.chunk != SIZE_MAX) {
+                    std::lock_guard<std::mutex> lk(violationMutex);
+                    if (violation.after(found.chunk, found.position)) {
+                        violation = found;
+                    }
+                }
+            });
+            for (size_t c = first; c < last; c++) {
+                _stats.generated += chunks[c].states.size();
+            }
+            if (needsGrow()) {
+                grow();
+            }
+            first = last;
         }
-    } catch (InvariantViolatedException& exp) {}
 
-    std::cout << "Model checking finished." << std::endl << getStats() << std::endl;
+        if (violation.chunk != SIZE_MAX) {
+            // Leave the counters and the queue as one worker leaves them when
+            // it stops at this state: only the successors up to it are
+            // counted and in the seen set, and the states after its parent
+            // are still queued.
+            size_t parent = chunks[violation.chunk].from[violation.position];
+            uint64_t generated = 0, unique = 0;
+            for (size_t c = 0; c < nChunks; c++) {
+                for (size_t p = 0; p < chunks[c].states.size(); p++) {
+                    uint8_t status = chunks[c].status[p];
+                    if (!violation.after(c, p) && (c != violation.chunk || p != violation.position)) {
+                        _seenPastViolation += status != 0;
+                        continue;
+                    }
+                    generated++;
+                    unique += status != 0;
+                    if (status == 1) {
+                        enqueue(*chunks[c].states[p], depth + 1);
+                    }
+                }
+            }
+            _stats.generated = generatedBefore + generated;
+            _stats.unique = uniqueBefore + unique;
+            for (size_t i = parent + 1; i < round.size(); i++) {
+                _unvisited.push(std::move(round[i]));
+            }
+            _stats.queued = _unvisited.size();
+            const StateType& state = *chunks[violation.chunk].states[violation.position];
+            reportViolation(trace(state), _seenStates->keepsParents() ? nullptr
+                            : "The seen set keeps no parent links, so only the last state is shown.");
+        }
+        for (size_t c = 0; c < nChunks; c++) {
+            for (size_t p = 0; p < chunks[c].states.size(); p++) {
+                if (chunks[c].status[p] == 1) {
+                    enqueue(*chunks[c].states[p], depth + 1);
+                }
+            }
+        }
+        _stats.queued = _unvisited.size();
+        if (_checkpointDue) {
+            writeCheckpoint();
+        }
+    }
 }
 
 template <class StateType>
 void Checker<StateType>::onNewState(const StateType& state) {
-    _stats.generated++;
+    // Successors only have somewhere to go while the checker runs generate().
+    assert(generatedStates != nullptr);
+    generatedStates->push_back(state);
+}
 
-    // If the fp doesn't exist in the unique map, add it.
-    auto fp = state.hash();
-    if (!_seenStates.insert({fp, state}).second) {
-        return;
+template <class StateType>
+void Checker<StateType>::onAction(const ActionFootprint& footprint, bool enabled, size_t begin) {
+    generatedActions->push_back(ActionRecord{footprint, enabled, begin, generatedStates->size()});
+}
+
+template <class StateType>
+void Checker<StateType>::checkStates(const StateType* states, size_t n, Fingerprint parent, uint32_t depth) {
+    static thread_local std::vector<Fingerprint> parents;
+    parents.assign(n, parent);
+    checkBatch(states, n, parents.data(), depth);
+}
+
+// Checks states reached from parents[i], all at depth. The batch is hashed
+// first and then deduplicated at once, which lets the seen set prefetch its
+// slots and the disk backend probe its runs in order.
+template <class StateType>
+void Checker<StateType>::checkBatch(const StateType* states, size_t n, const Fingerprint* parents,
+                                    uint32_t depth) {
+    static thread_local std::vector<Fingerprint> fps, localParents;
+    static thread_local std::vector<const StateType*> local;
+    static thread_local std::unique_ptr<bool[]> inserted;
+    static thread_local size_t insertedCapacity = 0;
+    fps.resize(n);
+    localParents.resize(n);
+    local.resize(n);
+    if (insertedCapacity < n) {
+        inserted.reset(new bool[n]);
+        insertedCapacity = n;
+    }
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        Fingerprint fp = states[i].hash();
+        if (_mesh && ownerOf(fp) != _mesh->rank()) {
+            // Another process owns it and checks it.
+            _stats.generated++;
+            sendState(states[i], fp, parents[i], depth);
+            continue;
+        }
+        fps[m] = fp;
+        localParents[m] = parents[i];
+        local[m++] = &states[i];
+    }
+    _seenStates->insertBatch(m, fps.data(), localParents.data(), inserted.get());
+
+    for (size_t i = 0; i < m; i++) {
+        const StateType& state = *local[i];
+        _stats.generated++;
+        if (inserted[i]) {
+            try {
+                checkNewState(state, fps[i], depth);
+            } catch (InvariantViolatedException& exp) {
+                for (size_t j = i + 1; j < m; j++) {
+                    _seenPastViolation += inserted[j];
+                }
+                throw;
+            }
+        } else if (_trackDepths && _depths.improve(fps[i], depth) && state.satisfyConstraint()) {
+            // Reached by a shorter path than before: its successors may now
+            // fit within the depth bound.
+            enqueue(state, depth);
+        }
     }
+}
+
+template <class StateType>
+void Checker<StateType>::checkNewState(const StateType& state, Fingerprint fp, uint32_t depth) {
     _stats.unique++;
+    if (_keepStates) {
+        _traceStates.insert(fp, state);
+    }
 
     // Check invariant.
     if (!state.satisfyInvariant()) {
-        std::cout << "Violated invariant." << std::endl;
-        auto errorTrace = trace(state);
-        for (size_t i = 0; i < errorTrace.size(); i++) {
-            std::cout << "State: " << i << std::endl << errorTrace[i] << std::endl << std::endl;
+        if (_violated) {
+            throw InvariantViolatedException();
         }
-        throw InvariantViolatedException();
+        if (_mesh) {
+            // The trace is spread over the processes; rank 0 collects it.
+            _violationFound = true;
+            _violation = fp;
+            throw InvariantViolatedException();
+        }
+        reportViolation(trace(state), _seenStates->keepsParents() ? nullptr
+                        : "The seen set keeps no parent links, so only the last state is shown.");
     }
 
     if (!state.satisfyConstraint()) return;
 
-    // Add the new to the unvisited queue.
-    _unvisited.push(state);
+    if (_trackDepths) {
+        _depths.improve(fp, depth);
+    }
+    enqueue(state, depth);
+}
+
+template <class StateType>
+void Checker<StateType>::enqueue(const StateType& state, uint32_t depth) {
+    if (depth >= _depthBound) {
+        // Its successors would be deeper than the bound.
+        _cutOff = true;
+        return;
+    }
+    if (_depthFirst) {
+        _stack.push_back(QueuedState<StateType>{state, depth});
+    } else if (localSuccessors) {
+        localSuccessors->push_back(QueuedState<StateType>{state, depth});
+    } else {
+        _unvisited.push(QueuedState<StateType>{state, depth});
+    }
+}
+
+template <class StateType>
+bool Checker<StateType>::needsGrow() const {
+    return _seenStates->needsGrow() || (_keepStates && _traceStates.needsGrow())
+        || (_expandedStates && _expandedStates->needsGrow());
+}
+
+template <class StateType>
+void Checker<StateType>::grow() {
+    if (_seenStates->needsGrow()) {
+        _seenStates->grow();
+    }
+    if (_keepStates && _traceStates.needsGrow()) {
+        _traceStates.grow();
+    }
+    if (_expandedStates && _expandedStates->needsGrow()) {
+        _expandedStates->grow();
+    }
+    _stats.seenBytes = _seenStates->memoryBytes() + (_keepStates ? _traceStates.memoryBytes() : 0)
+                     + (_trackDepths ? _depths.memoryBytes() : 0);
+}
+
+// The fingerprints of the initial states stand in for the model.
+template <class StateType>
+std::string Checker<StateType>::checkpointHeader(const std::vector<StateType>& initialStates,
+                                                 const CheckerOptions& options) const {
+    uint64_t values[] = {uint64_t(kFingerprintBits), sizeof(StateType), uint64_t(options.seenBackend),
+                         _keepStates, _partialOrder, initialStates.size()};
+    std::string header(reinterpret_cast<const char*>(values), sizeof(values));
+    for (auto& state : initialStates) {
+        Fingerprint fp = state.hash();
+        header.append(reinterpret_cast<const char*>(&fp), sizeof(fp));
+    }
+    return header;
+}
+
+// Called between expansions, with no worker busy.
+template <class StateType>
+void Checker<StateType>::writeCheckpoint() {
+    auto start = std::chrono::steady_clock::now();
+    CheckpointWriter out(_checkpointPath);
+    out.writeValue(kCheckpointMagic);
+    out.writeBytes(_checkpointHeader);
+    out.writeValue<uint64_t>(_stats.generated);
+    out.writeValue<uint64_t>(_stats.unique);
+    out.writeValue<uint64_t>(_stats.depth);
+    _seenStates->save(out);
+    if (_expandedStates) {
+        _expandedStates->save(out);
+    }
+    if (_keepStates) {
+        _traceStates.template save<StateCodec<StateType>>(out);
+    }
+    _unvisited.save(out);
+    out.commit();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Checkpointed " << _stats.unique.load() << " states and " << _unvisited.size()
+              << " queued states to " << _checkpointPath << " (" << (out.size() >> 20) << "MB) in "
+              << seconds << "s." << std::endl;
+    // The next interval starts once this checkpoint is written, so the
+    // search gets a whole interval of progress however long writing took.
+    _checkpointTimer->restart();
+    _checkpointDue = false;
+}
+
+template <class StateType>
+void Checker<StateType>::readCheckpoint(const std::string& path) {
+    CheckpointReader in(path);
+    if (in.readValue<uint64_t>() != kCheckpointMagic) {
+        in.fail("not a checkpoint");
+    }
+    std::string header;
+    in.readBytes(header);
+    if (header != _checkpointHeader) {
+        in.fail("saved from another model or build, or with other --seen, --fingerprints-only or --por "
+                "options, or the model has states that are neither flat nor serialized");
+    }
+    _stats.generated = in.readValue<uint64_t>();
+    _stats.unique = in.readValue<uint64_t>();
+    _stats.depth = in.readValue<uint64_t>();
+    _seenStates->load(in);
+    if (_expandedStates) {
+        _expandedStates->load(in);
+    }
+    if (_keepStates) {
+        _traceStates.template load<StateCodec<StateType>>(in);
+    }
+    _unvisited.load(in);
+    _stats.queued = _unvisited.size();
+    // Refreshes seenBytes.
+    grow();
+    std::cout << "Resumed from " << path << " at " << _stats << " queue: " << _unvisited.size() << std::endl;
+}
+
+// Every process runs this loop on one thread: it explores a slice of its
+// queue, sends the successors other processes own once their batches fill
+// up or it runs out of work, and handles what the others sent. The end of
+// the search is detected with Safra's algorithm. A token goes round the ring
+// of processes, passed on by each only while it is idle. It sums the batches
+// every process has sent minus those it has received, and turns black at a
+// process that received a batch since it last passed the token. When the
+// token comes back to an idle rank 0 white with a sum of zero, and rank 0
+// received nothing in the meantime either, no batch is in flight and every
+// process is idle.
+template <class StateType>
+void Checker<StateType>::exploreDistributed(const std::vector<StateType>& initialStates,
+                                            const CheckerOptions& options) {
+    const size_t kSlice = 256;
+    const size_t rank = _mesh->rank(), processes = _mesh->size();
+    _outgoing.assign(processes, std::string());
+    _progress.assign(processes, std::array<uint64_t, 6>());
+    _batchBalance = 0;
+    _receivedBatch = false;
+    _violationFound = false;
+
+    bool exploring = true;
+    bool holdingToken = rank == 0, roundStarted = false, tokenBlack = false;
+    int64_t tokenCount = 0;
+    auto interval = std::chrono::duration<double>(options.reportInterval);
+    auto lastProgress = std::chrono::steady_clock::now();
+
+    if (rank == 0) {
+        try {
+            checkStates(initialStates.data(), initialStates.size(), 0, 0);
+        } catch (InvariantViolatedException& exp) {}
+    }
+    std::vector<ProcessMesh::Message> messages;
+    while (true) {
+        try {
+            for (size_t i = 0; i < kSlice && exploring && !_violationFound && !_unvisited.empty(); i++) {
+                explore(popUnvisited());
+                if (needsGrow()) {
+                    grow();
+                }
+            }
+        } catch (InvariantViolatedException& exp) {}
+        _stats.queued = _unvisited.size();
+
+        if (_violationFound && exploring) {
+            exploring = false;
+            if (rank == 0) {
+                for (size_t p = 1; p < processes; p++) {
+                    _mesh->send(p, kStop, std::string());
+                }
+                try {
+                    reportViolation(collectTrace(_violation));
+                } catch (InvariantViolatedException& exp) {}
+                finishDistributed();
+                return;
+            }
+            _mesh->send(0, kViolation, std::string(reinterpret_cast<const char*>(&_violation), sizeof(Fingerprint)));
+        }
+
+        bool idle = !exploring || _unvisited.empty();
+        if (idle) {
+            for (size_t p = 0; p < processes; p++) {
+                sendStates(p);
+            }
+        }
+        messages.clear();
+        _mesh->poll(idle ? 10 : 0, messages);
+        for (auto& m : messages) {
+            switch (m.type) {
+            case kStates:
+                _batchBalance--;
+                _receivedBatch = true;
+                if (exploring && !_violationFound) {
+                    try {
+                        receiveStates(m.payload);
+                    } catch (InvariantViolatedException& exp) {}
+                }
+                break;
+            case kToken:
+                holdingToken = true;
+                memcpy(&tokenCount, m.payload.data(), sizeof(tokenCount));
+                tokenBlack = m.payload[sizeof(tokenCount)];
+                break;
+            case kViolation:
+                // Only the first violation rank 0 hears of is reported.
+                if (exploring && !_violationFound) {
+                    _violationFound = true;
+                    memcpy(&_violation, m.payload.data(), sizeof(Fingerprint));
+                }
+                break;
+            case kStop:
+                exploring = false;
+                break;
+            case kParentRequest:
+                answerParentRequest(m.from, m.payload);
+                break;
+            case kProgress:
+                addProgress(m.from, m.payload);
+                break;
+            case kDone:
+                sendProgress(kFinal);
+                _mesh->flush();
+                return;
+            }
+        }
+        // Rank 0 watches every process, and the others watch rank 0: they exit
+        // in any order once told the search is done.
+        for (size_t p = 0; p < (rank == 0 ? processes : 1); p++) {
+            if (_mesh->closed(p)) {
+                std::cerr << "Checker process " << p << " exited before the search finished." << std::endl;
+                abort();
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (rank == 0) {
+            sumProgress();
+        } else if (options.reportInterval > 0 && now - lastProgress >= interval) {
+            sendProgress(kProgress);
+            lastProgress = now;
+        }
+
+        bool passive = _unvisited.empty() && std::all_of(_outgoing.begin(), _outgoing.end(),
+                [](const std::string& batch) { return batch.empty(); });
+        if (!holdingToken || !exploring || _violationFound || !passive) continue;
+        if (rank == 0 && roundStarted && !tokenBlack && !_receivedBatch && tokenCount + _batchBalance == 0) {
+            finishDistributed();
+            return;
+        }
+        // Rank 0 starts a new round; the others pass the token on.
+        std::string token(sizeof(tokenCount) + 1, '\0');
+        int64_t count = rank == 0 ? 0 : tokenCount + _batchBalance;
+        memcpy(&token[0], &count, sizeof(count));
+        token[sizeof(count)] = rank != 0 && (tokenBlack || _receivedBatch);
+        _mesh->send((rank + 1) % processes, kToken, token);
+        roundStarted = true;
+        _receivedBatch = false;
+        holdingToken = false;
+    }
+}
+
+// Spreads fingerprints over the processes by their top bits after a
+// multiplicative mix, so that the tables of every process, which index by
+// the low bits and partition by the high ones, still see them uniformly.
+template <class StateType>
+size_t Checker<StateType>::ownerOf(Fingerprint fp) const {
+    uint64_t h = foldFingerprint(fp) * 0x9e3779b97f4a7c15ull;
+    return size_t((__uint128_t(h) * _mesh->size()) >> 64);
+}
+
+template <class StateType>
+void Checker<StateType>::sendState(const StateType& state, Fingerprint fp, Fingerprint parent, uint32_t depth) {
+    const size_t kBatchBytes = 1 << 16;
+    static thread_local std::string encoded;
+    size_t owner = ownerOf(fp);
+    auto& batch = _outgoing[owner];
+    // The owner fingerprints the state again from its encoding.
+    batch.append(reinterpret_cast<const char*>(&parent), sizeof(parent));
+    writeVarint(batch, depth);
+    encoded.clear();
+    StateCodec<StateType>::encode(state, encoded);
+    writeVarint(batch, encoded.size());
+    batch.append(encoded);
+    if (batch.size() >= kBatchBytes) {
+        sendStates(owner);
+    }
+}
+
+template <class StateType>
+void Checker<StateType>::sendStates(size_t process) {
+    if (_outgoing[process].empty()) return;
+    _mesh->send(process, kStates, _outgoing[process]);
+    _outgoing[process].clear();
+    _batchBalance++;
+}
+
+// A batch is fingerprinted from its encoded states and deduplicated as a
+// whole, and only the states new to this process are decoded.
+template <class StateType>
+void Checker<StateType>::receiveStates(const std::string& batch) {
+    static thread_local std::vector<Fingerprint> fps, parents;
+    static thread_local std::vector<uint32_t> depths;
+    static thread_local std::vector<EncodedState<StateType>> encoded;
+    fps.clear();
+    parents.clear();
+    depths.clear();
+    encoded.clear();
+    const char* in = batch.data();
+    const char* end = in + batch.size();
+    while (in < end) {
+        Fingerprint parent;
+        memcpy(&parent, in, sizeof(parent));
+        in += sizeof(parent);
+        parents.push_back(parent);
+        depths.push_back(readVarint(in));
+        size_t bytes = readVarint(in);
+        encoded.emplace_back(in, bytes);
+        fps.push_back(encoded.back().fingerprint());
+        in += bytes;
+    }
+    std::unique_ptr<bool[]> inserted(new bool[fps.size()]);
+    for (size_t first = 0; first < fps.size();) {
+        // Like the levels scheduler, insert no more than the tables take
+        // before they grow, and grow them in between.
+        size_t n = std::min(fps.size() - first, std::max<size_t>(8, _seenStates->size()));
+        _seenStates->insertBatch(n, &fps[first], &parents[first], &inserted[first]);
+        for (size_t i = first; i < first + n; i++) {
+            if (inserted[i]) {
+                checkNewState(encoded[i].decode(), fps[i], depths[i]);
+            }
+        }
+        first += n;
+        if (needsGrow()) {
+            grow();
+        }
+    }
+}
+
+// A reply is whether the state was found, its parent, and the state itself
+// if states are kept.
+template <class StateType>
+void Checker<StateType>::answerParentRequest(size_t process, const std::string& request) {
+    Fingerprint fp, parent = 0;
+    memcpy(&fp, request.data(), sizeof(fp));
+    bool found = _seenStates->find(fp, &parent);
+    std::string reply(1, char(found));
+    reply.append(reinterpret_cast<const char*>(&parent), sizeof(parent));
+    StateType state;
+    if (found && _keepStates && _traceStates.find(fp, &state)) {
+        StateCodec<StateType>::encode(state, reply);
+    }
+    _mesh->send(process, kParentReply, reply);
+}
+
+// In rank 0, walks the parent links back from fp through the processes that
+// own each state.
+template <class StateType>
+std::vector<StateType> Checker<StateType>::collectTrace(Fingerprint fp) {
+    std::vector<Fingerprint> fps;
+    std::vector<StateType> trace;
+    while (true) {
+        fps.push_back(fp);
+        Fingerprint parent = 0;
+        StateType state;
+        size_t owner = ownerOf(fp);
+        if (owner == 0) {
+            if (!_seenStates->find(fp, &parent)) break;
+            if (_keepStates) _traceStates.find(fp, &state);
+        } else {
+            _mesh->send(owner, kParentRequest, std::string(reinterpret_cast<const char*>(&fp), sizeof(fp)));
+            auto reply = awaitMessage(owner, kParentReply);
+            if (!reply.payload[0]) break;
+            memcpy(&parent, &reply.payload[1], sizeof(parent));
+            if (_keepStates) {
+                const char* in = &reply.payload[1 + sizeof(parent)];
+                state = StateCodec<StateType>::decode(in);
+            }
+        }
+        trace.push_back(state);
+        if (parent == 0) break;
+        fp = parent;
+    }
+    std::reverse(fps.begin(), fps.end());
+    std::reverse(trace.begin(), trace.end());
+    return _keepStates ? trace : replayTrace(fps);
+}
+
+// Waits for a message of the given type from process. Progress is recorded
+// and everything else is dropped: the search has stopped.
+template <class StateType>
+ProcessMesh::Message Checker<StateType>::awaitMessage(size_t process, uint8_t type) {
+    std::vector<ProcessMesh::Message> messages;
+    while (true) {
+        messages.clear();
+        _mesh->poll(-1, messages);
+        for (auto& m : messages) {
+            if (m.from == process && m.type == type) {
+                return std::move(m);
+            }
+            if (m.type == kProgress) {
+                addProgress(m.from, m.payload);
+            }
+        }
+        if (_mesh->closed(process)) {
+            std::cerr << "Checker process " << process << " exited before the search finished." << std::endl;
+            abort();
+        }
+    }
+}
+
+template <class StateType>
+void Checker<StateType>::sendProgress(uint8_t type) {
+    uint64_t progress[] = {_stats.generated, _stats.unique, _unvisited.size(), _stats.depth,
+                           _stats.seenBytes, _seenStates->size()};
+    _mesh->send(0, type, std::string(reinterpret_cast<const char*>(progress), sizeof(progress)));
+}
+
+template <class StateType>
+void Checker<StateType>::addProgress(size_t process, const std::string& progress) {
+    memcpy(_progress[process].data(), progress.data(), sizeof(_progress[process]));
+}
+
+// In rank 0, refreshes the counters the reports show.
+template <class StateType>
+void Checker<StateType>::sumProgress() {
+    uint64_t generated = _stats.generated, unique = _stats.unique, queued = _unvisited.size();
+    uint64_t depth = _stats.depth, seenBytes = _stats.seenBytes;
+    _remoteSeen = 0;
+    for (size_t p = 1; p < _progress.size(); p++) {
+        generated += _progress[p][0];
+        unique += _progress[p][1];
+        queued += _progress[p][2];
+        depth = std::max(depth, _progress[p][3]);
+        seenBytes += _progress[p][4];
+        _remoteSeen += _progress[p][5];
+    }
+    _clusterStats.generated = generated;
+    _clusterStats.unique = unique;
+    _clusterStats.queued = queued;
+    _clusterStats.depth = depth;
+    _clusterStats.seenBytes = seenBytes;
+}
+
+// In rank 0, ends the search and adds up the final counters of every process.
+template <class StateType>
+void Checker<StateType>::finishDistributed() {
+    for (size_t p = 1; p < _mesh->size(); p++) {
+        _mesh->send(p, kDone, std::string());
+    }
+    std::vector<bool> finished(_mesh->size(), false);
+    finished[0] = true;
+    std::vector<ProcessMesh::Message> messages;
+    while (!std::all_of(finished.begin(), finished.end(), [](bool f) { return f; })) {
+        messages.clear();
+        _mesh->poll(-1, messages);
+        for (auto& m : messages) {
+            if (m.type == kFinal) {
+                addProgress(m.from, m.payload);
+                finished[m.from] = true;
+            }
+        }
+        for (size_t p = 1; p < _mesh->size(); p++) {
+            if (!finished[p] && _mesh->closed(p)) {
+                std::cerr << "Checker process " << p << " exited before the search finished." << std::endl;
+                abort();
+            }
+        }
+    }
+    sumProgress();
+    _stats.generated = _clusterStats.generated.load();
+    _stats.unique = _clusterStats.unique.load();
+    _stats.depth = _clusterStats.depth.load();
+    _stats.seenBytes = _clusterStats.seenBytes.load();
 }
 
 template <class StateType>
 std::vector<StateType> Checker<StateType>::trace(const StateType& endState) const {
+    if (!_seenStates->keepsParents()) {
+        return {endState};
+    }
+    // Walk the parent links back to an initial state.
+    std::vector<Fingerprint> fps;
+    for (auto fp = endState.hash(); fp != 0;) {
+        fps.push_back(fp);
+        if (!_seenStates->find(fp, &fp)) break;
+    }
+    std::reverse(fps.begin(), fps.end());
+
+    if (!_keepStates) {
+        return replayTrace(fps);
+    }
+
     std::vector<StateType> trace;
+    for (size_t i = 0; i + 1 < fps.size(); i++) {
+        StateType state;
+        _traceStates.find(fps[i], &state);
+        trace.push_back(state);
+    }
     trace.push_back(endState);
-    auto cur = endState;
-    while (cur.prevHash != 0) {
-        cur = _seenStates.find(cur.prevHash)->second;
-        trace.push_back(cur);
+    return trace;
+}
+
+template <class StateType>
+std::vector<StateType> Checker<StateType>::replayTrace(std::vector<Fingerprint> fps) const {
+    std::vector<StateType> trace;
+    std::vector<StateType> candidates = _initialStates;
+    StateBuffer<StateType> successors;
+    for (auto fp : fps) {
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](const StateType& s) {
+            return s.hash() == fp;
+        });
+        if (it == candidates.end()) {
+            std::cout << "Failed to rebuild the trace: no successor matches fingerprint " << fp << std::endl;
+            break;
+        }
+        trace.push_back(*it);
+
+        // Generate the successors of the state, this time without checking them.
+        generateSuccessors(*it, successors);
+        candidates.assign(successors.begin(), successors.end());
     }
-    std::reverse(trace.begin(), trace.end());
     return trace;
 }
 
+template <class StateType>
+void Checker<StateType>::Reporter::report() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _start).count();
+    double interval = std::chrono::duration<double>(now - _last).count();
+    uint64_t generated = _stats.generated;
+    uint64_t unique = _stats.unique;
+    uint64_t generatedRate = (generated - _lastGenerated) / interval;
+    uint64_t uniqueRate = (unique - _lastUnique) / interval;
+    _last = now;
+    _lastGenerated = generated;
+    _lastUnique = unique;
+
+    std::stringstream str;
+    if (_format == ReportFormat::Json) {
+        str << "{\"time\": " << elapsed
+            << ", \"generated\": " << generated
+            << ", \"unique\": " << unique
+            << ", \"generated_per_sec\": " << generatedRate
+            << ", \"unique_per_sec\": " << uniqueRate
+            << ", \"queue\": " << _stats.queued.load()
+            << ", \"depth\": " << _stats.depth.load()
+            << ", \"seen_bytes\": " << _stats.seenBytes.load() << "}";
+    } else {
+        str << "[" << elapsed << "s] generated: " << generated << " unique: " << unique
+            << " states/sec: " << generatedRate << " (unique: " << uniqueRate << ")"
+            << " queue: " << _stats.queued.load() << " depth: " << _stats.depth.load()
+            << " seen memory: " << (_stats.seenBytes.load() >> 20) << "MB";
+    }
+    str << std::endl;
+    std::cout << str.str() << std::flush;
+}
+
 template <class StateType>
 std::string Checker<StateType>::getStats() const {
     std::stringstream str;
-    str << _stats << " hash table size: " << _seenStates.size();
+    str << _stats << " hash table size: " << _seenStates->size() + _remoteSeen - _seenPastViolation;
     return str.str();
-}
\ No newline at end of file
+}
+
+//
+// Fixed-capacity containers for model states. They keep their elements
+// inline and zero every unused slot, so a state built from them is trivially
+// copyable and its bytes are determined by its value.
+//
+
+// Prints integers that are chars to the standard library as numbers.
+template <class T>
+void printElement(std::ostream& out, const T& e, typename std::enable_if<!std::is_integral<T>::value>::type* = 0) {
+    out << e;
+}
+template <class T>
+void printElement(std::ostream& out, const T& e, typename std::enable_if<std::is_integral<T>::value>::type* = 0) {
+    out << +e;
+}
+
+// A vector of at most N trivially copyable elements.
+template <class T, size_t N>
+class BoundedVector {
+    static_assert(std::is_trivially_copyable<T>::value, "BoundedVector elements must be trivially copyable.");
+public:
+    using value_type = T;
+    using SizeType = typename std::conditional<N <= UINT8_MAX, uint8_t,
+                     typename std::conditional<N <= UINT16_MAX, uint16_t, uint32_t>::type>::type;
+
+    BoundedVector() {}
+    BoundedVector(size_t n, const T& value) {
+        assert(n <= N);
+        std::fill(_items, _items + n, value);
+        _size = n;
+    }
+    BoundedVector(std::initializer_list<T> items) : BoundedVector(items.begin(), items.end()) {}
+    template <class It>
+    BoundedVector(It first, It last) {
+        for (; first != last; ++first) push_back(*first);
+    }
+
+    static constexpr size_t capacity() { return N; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    bool full() const { return _size == N; }
+
+    T& operator[](size_t i) { return _items[i]; }
+    const T& operator[](size_t i) const { return _items[i]; }
+    T& front() { return _items[0]; }
+    const T& front() const { return _items[0]; }
+    T& back() { return _items[_size - 1]; }
+    const T& back() const { return _items[_size - 1]; }
+    T* data() { return _items; }
+    const T* data() const { return _items; }
+    T* begin() { return _items; }
+    const T* begin() const { return _items; }
+    T* end() { return _items + _size; }
+    const T* end() const { return _items + _size; }
+
+    void push_back(const T& e) {
+        assert(_size < N);
+        _items[_size++] = e;
+    }
+    void pop_back() {
+        assert(_size > 0);
+        _items[--_size] = T();
+    }
+    void resize(size_t n, const T& value = T()) {
+        assert(n <= N);
+        if (n > _size) {
+            std::fill(_items + _size, _items + n, value);
+        } else {
+            std::fill(_items + n, _items + _size, T());
+        }
+        _size = n;
+    }
+    void clear() { resize(0); }
+
+    friend bool operator==(const BoundedVector& lhs, const BoundedVector& rhs) {
+        return lhs._size == rhs._size && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+    }
+    friend bool operator!=(const BoundedVector& lhs, const BoundedVector& rhs) {
+        return !(lhs == rhs);
+    }
+    friend bool operator<(const BoundedVector& lhs, const BoundedVector& rhs) {
+        return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+    }
+
+    // Hashes like a std::vector with the same elements.
+    template <typename H>
+    friend H AbslHashValue(H h, const BoundedVector& v) {
+        return H::combine(H::combine_contiguous(std::move(h), v.data(), v.size()), v.size());
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const BoundedVector& v) {
+        out << "[";
+        for (size_t i = 0; i < v.size(); i++) {
+            printElement(out, v[i]);
+            out << (i + 1 == v.size() ? "" : ",");
+        }
+        return out << "]";
+    }
+
+private:
+    SizeType _size = 0;
+    T _items[N] = {};
+};
+
+template <class T, size_t N>
+struct FieldCodec<BoundedVector<T, N>> {
+    static void encode(const BoundedVector<T, N>& v, std::string& out) {
+        writeVarint(out, v.size());
+        for (const auto& e : v) FieldCodec<T>::encode(e, out);
+    }
+    static BoundedVector<T, N> decode(const char*& in) {
+        BoundedVector<T, N> v;
+        for (size_t n = readVarint(in); n > 0; n--) v.push_back(FieldCodec<T>::decode(in));
+        return v;
+    }
+};
+
+// Up to Count sequences of up to Capacity elements each, such as the logs of
+// every node.
+template <class T, size_t Count, size_t Capacity>
+using BoundedSequences = BoundedVector<BoundedVector<T, Capacity>, Count>;
+
+// A set of enum values below N, one bit each.
+template <class E, size_t N>
+class EnumBitset {
+    static_assert(N <= 64, "EnumBitset holds at most 64 values.");
+public:
+    using Bits = typename std::conditional<N <= 8, uint8_t,
+                 typename std::conditional<N <= 16, uint16_t,
+                 typename std::conditional<N <= 32, uint32_t, uint64_t>::type>::type>::type;
+
+    EnumBitset() {}
+    EnumBitset(std::initializer_list<E> values) {
+        for (auto e : values) set(e);
+    }
+
+    bool test(E e) const { return _bits & bit(e); }
+    void set(E e) { _bits |= bit(e); }
+    void reset(E e) { _bits &= ~bit(e); }
+    void clear() { _bits = 0; }
+    size_t count() const { return __builtin_popcountll(_bits); }
+    bool empty() const { return _bits == 0; }
+    Bits bits() const { return _bits; }
+
+    friend bool operator==(const EnumBitset& lhs, const EnumBitset& rhs) { return lhs._bits == rhs._bits; }
+    friend bool operator!=(const EnumBitset& lhs, const EnumBitset& rhs) { return lhs._bits != rhs._bits; }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const EnumBitset& s) {
+        return H::combine(std::move(h), s._bits);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const EnumBitset& s) {
+        out << "{";
+        bool first = true;
+        for (size_t i = 0; i < N; i++) {
+            if (!s.test(E(i))) continue;
+            out << (first ? "" : ",") << E(i);
+            first = false;
+        }
+        return out << "}";
+    }
+
+private:
+    static Bits bit(E e) {
+        assert(size_t(e) < N);
+        return Bits(1) << size_t(e);
+    }
+
+    Bits _bits = 0;
+};
+
+template <class E, size_t N>
+struct FieldCodec<EnumBitset<E, N>> {
+    static void encode(const EnumBitset<E, N>& s, std::string& out) { writeVarint(out, s.bits()); }
+    static EnumBitset<E, N> decode(const char*& in) {
+        EnumBitset<E, N> s;
+        for (uint64_t bits = readVarint(in); bits != 0; bits &= bits - 1) {
+            s.set(E(__builtin_ctzll(bits)));
+        }
+        return s;
+    }
+};
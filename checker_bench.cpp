@@ -0,0 +1,695 @@
+/**
+ * Benchmarks of the checker core on real and synthetic models.
+ *
+ * Every model is checked once per seen-set backend and worker count, each run
+ * in a forked child so that peak RSS and the checker singletons belong to that
+ * run alone.
+ *
+ *     checker_bench [--models=diehard,mongo_n3_t4_l4,...] [--workers=1,4]
+ *                   [--seen=memory,disk,bitstate] [--report-format=text|json]
+ *
+ * Other options (--queue-memory=, --disk-dir=, --fingerprints-only, --por, ...)
+ * are passed to every run.
+ *
+ *     checker_bench --check [--models=...]
+ *
+ * instead runs every scheduler and seen-set backend, with tables that start
+ * small, frequent checkpoints and several processes, and fails unless each
+ * finds as many states as one worker does.
+ */
+
+#include <cstddef>
+
+#include "checker.h"
+#include <functional>
+#include <iomanip>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//
+// DieHard, as in die_hard_checker.cpp.
+//
+struct DieHardState : public ModelState<DieHardState> {
+    int8_t big = 0;
+    int8_t small = 0;
+
+    friend bool operator==(const DieHardState& lhs, const DieHardState& rhs) {
+        return lhs.big == rhs.big && lhs.small == rhs.small;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const DieHardState& s) {
+        return H::combine(std::move(h), s.big, s.small);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const DieHardState& s) {
+        return out << "[big: " << (int)s.big << ", small: " << (int)s.small << "]";
+    }
+    // The benchmark explores the whole space, so the puzzle is never "solved".
+    bool satisfyInvariant() const { return true; }
+    bool satisfyConstraint() const { return true; }
+    void generate() {
+        either([&](){ small = 3; });
+        either([&](){ big = 5; });
+        either([&](){ small = 0; });
+        either([&](){ big = 0; });
+        either([&](){
+            if (big + small > 5) {
+                small = big + small - 5;
+                big = 5;
+            } else {
+                big += small;
+                small = 0;
+            }
+        });
+        either([&](){
+            if (big + small > 3) {
+                big = big + small - 3;
+                small = 3;
+            } else {
+                small += big;
+                big = 0;
+            }
+        });
+    }
+};
+
+//
+// The model of mongo_raft_checker.cpp with the node count, MAX_TERM and
+// MAX_LOG_SIZE as parameters.
+//
+enum BenchRaftState : uint8_t { BenchPrimary, BenchSecondary };
+
+std::ostream& operator << (std::ostream &out, const BenchRaftState state) {
+    return out << (state == BenchPrimary ? "Primary" : "Secondary");
+}
+
+template <size_t Nodes, int MaxTerm, int MaxLogSize>
+struct BenchMongoState : public ModelState<BenchMongoState<Nodes, MaxTerm, MaxLogSize>> {
+    using TermType = uint8_t;
+    using Log = BoundedVector<TermType, MaxLogSize + 1>;
+    using Logs = BoundedSequences<TermType, Nodes, MaxLogSize + 1>;
+    using RaftStates = BoundedVector<BenchRaftState, Nodes>;
+
+    TermType globalCurrentTerm = 0;
+    RaftStates states = RaftStates(Nodes, BenchSecondary);
+    Logs logs = Logs(Nodes, Log());
+
+    friend bool operator==(const BenchMongoState& lhs, const BenchMongoState& rhs) {
+        return lhs.globalCurrentTerm == rhs.globalCurrentTerm
+            && lhs.states == rhs.states
+            && lhs.logs == rhs.logs;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const BenchMongoState& s) {
+        return H::combine(std::move(h), s.globalCurrentTerm, s.states, s.logs);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const BenchMongoState& s) {
+        return out << " [globalCurrentTerm: " << (int)s.globalCurrentTerm
+                   << ", states: " << s.states  << ", logs: " << s.logs << "]";
+    }
+
+    static const size_t kSymmetricIndices = Nodes;
+    bool symmetricLess(size_t a, size_t b) const {
+        return states[a] != states[b] ? states[a] < states[b] : logs[a] < logs[b];
+    }
+    void permute(const Permutation<Nodes>& p) {
+        p.apply(states);
+        p.apply(logs);
+    }
+
+    bool satisfyConstraint() const {
+        if (globalCurrentTerm > MaxTerm) return false;
+        return std::all_of(logs.begin(), logs.end(), [&](const Log& log){
+            return log.size() <= MaxLogSize;
+        });
+    }
+
+    static bool isMajority(size_t nodeCount) {
+        return nodeCount * 2 > Nodes;
+    }
+
+    static bool canRollbackOplog(const Log& rlog, const Log& slog) {
+        if (rlog.empty() || slog.empty()) return false;
+        return rlog.back() < slog.back()
+            && (rlog.size() > slog.size() || slog[rlog.size() - 1] != rlog.back());
+    }
+
+    bool rollbackCommitted(size_t me) const {
+        const auto& myLog = logs[me];
+        if (myLog.empty()) return false;
+        if (myLog.back() != globalCurrentTerm) return false;
+
+        size_t replicaCount = std::count_if(logs.begin(), logs.end(), [&](const Log& log) {
+            return log.size() >= myLog.size() && log[myLog.size() - 1] == myLog.back();
+        });
+        if (!isMajority(replicaCount)) return false;
+
+        return std::any_of(logs.begin(), logs.end(), [&](const Log& log) {
+            return canRollbackOplog(myLog, log);
+        });
+    }
+
+    bool satisfyInvariant() const {
+        for (size_t n = 0; n < Nodes; n++) {
+            if (states[n] == BenchPrimary && rollbackCommitted(n)) return false;
+        }
+        return true;
+    }
+
+    static bool notBehind(const Log& me, const Log& syncSource) {
+        if (syncSource.empty()) return true;
+        if (me.empty()) return false;
+        return (me.back() > syncSource.back())
+            || (me.back() == syncSource.back() && me.size() >= syncSource.size());
+    }
+
+    void generate() {
+        for (size_t receiver = 0; receiver < Nodes; receiver++) {
+            for (size_t sender = 0; sender < Nodes; sender++) {
+                auto& rlog = logs[receiver];
+                auto& slog = logs[sender];
+                // AppendOplog
+                if (rlog.size() < slog.size() && (rlog.empty() || slog[rlog.size() - 1] == rlog.back())) {
+                    this->either([&]() {
+                        rlog.push_back(slog[rlog.size()]);
+                    });
+                }
+                // RollbackOplog
+                if (canRollbackOplog(rlog, slog)) {
+                    this->either([&]() {
+                        rlog.pop_back();
+                    });
+                }
+            }
+        }
+
+        for (size_t n = 0; n < Nodes; n++) {
+            // BecomePrimaryByMagic
+            size_t notBehindCount = std::count_if(logs.begin(), logs.end(), [&](const Log& log) {
+                return notBehind(logs[n], log);
+            });
+            if (isMajority(notBehindCount)) {
+                this->either([&]() {
+                    for (auto& s : states) {
+                        s = BenchSecondary;
+                    }
+                    states[n] = BenchPrimary;
+                    globalCurrentTerm++;
+                });
+            }
+            // ClientWrite
+            if (states[n] == BenchPrimary) {
+                this->either([&]() {
+                    logs[n].push_back(globalCurrentTerm);
+                });
+            }
+        }
+    }
+};
+
+//
+// Vars variables over Values values; any variable may be set to any other
+// value, so every state has Vars * (Values - 1) successors and the space has
+// Values^Vars states.
+//
+template <size_t Vars, uint8_t Values>
+struct WideFanoutState : public ModelState<WideFanoutState<Vars, Values>> {
+    std::array<uint8_t, Vars> vars = {};
+
+    friend bool operator==(const WideFanoutState& lhs, const WideFanoutState& rhs) {
+        return lhs.vars == rhs.vars;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const WideFanoutState& s) {
+        return H::combine(std::move(h), s.vars);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const WideFanoutState& s) {
+        out << "[";
+        for (size_t i = 0; i < Vars; i++) {
+            out << (i ? "," : "") << (int)s.vars[i];
+        }
+        return out << "]";
+    }
+    bool satisfyInvariant() const { return true; }
+    bool satisfyConstraint() const { return true; }
+    void generate() {
+        for (size_t i = 0; i < Vars; i++) {
+            for (uint8_t v = 0; v < Values; v++) {
+                if (v == vars[i]) continue;
+                this->either([&]() { vars[i] = v; });
+            }
+        }
+    }
+};
+
+//
+// Processes processes that each take Steps local steps and then increment a
+// shared counter. Interleavings of the local steps make the space about
+// (Steps + 1)^Processes states, but the steps are independent, so the
+// actions are annotated for --por.
+//
+template <size_t Processes, uint8_t Steps>
+struct IndependentProcessesState : public ModelState<IndependentProcessesState<Processes, Steps>> {
+    static_assert(Processes < 64, "One variable per process and one for the counter.");
+    std::array<uint8_t, Processes> pcs = {};
+    uint8_t finished = 0;
+
+    // Variable p is pcs[p], and variable Processes the counter.
+    static const uint64_t kFinished = uint64_t(1) << Processes;
+    static const uint64_t kVisibleVariables = kFinished;
+
+    friend bool operator==(const IndependentProcessesState& lhs, const IndependentProcessesState& rhs) {
+        return lhs.pcs == rhs.pcs && lhs.finished == rhs.finished;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const IndependentProcessesState& s) {
+        return H::combine(std::move(h), s.pcs, s.finished);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const IndependentProcessesState& s) {
+        out << "[pcs:";
+        for (auto pc : s.pcs) out << " " << (int)pc;
+        return out << ", finished: " << (int)s.finished << "]";
+    }
+    bool satisfyInvariant() const { return finished <= Processes; }
+    bool satisfyConstraint() const { return true; }
+    void generate() {
+        for (size_t p = 0; p < Processes; p++) {
+            uint64_t pc = uint64_t(1) << p;
+            // Step
+            this->action({pc, pc}, pcs[p] < Steps, [&]() { pcs[p]++; });
+            // Finish
+            this->action({pc | kFinished, pc | kFinished, pc}, pcs[p] == Steps, [&]() {
+                pcs[p]++;
+                finished++;
+            });
+        }
+    }
+};
+
+//
+// Two FIFO channels of up to Capacity messages out of Values; either end of
+// either channel may send any message while it is not full, or receive the
+// oldest one. The channels are std::vectors, so the state is not flat: the
+// trace store keeps it encoded in its arenas, and it is fingerprinted by its
+// encoding.
+//
+template <uint8_t Values, size_t Capacity>
+struct ChannelsState : public ModelState<ChannelsState<Values, Capacity>> {
+    std::vector<uint8_t> channels[2];
+
+    friend bool operator==(const ChannelsState& lhs, const ChannelsState& rhs) {
+        return lhs.channels[0] == rhs.channels[0] && lhs.channels[1] == rhs.channels[1];
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const ChannelsState& s) {
+        return H::combine(std::move(h), s.channels[0], s.channels[1]);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const ChannelsState& s) {
+        for (size_t c = 0; c < 2; c++) {
+            out << (c ? " " : "[") << "channel " << c << ":";
+            for (auto m : s.channels[c]) out << " " << (int)m;
+        }
+        return out << "]";
+    }
+
+    void serialize(std::string& out) const { encodeFields(out, channels[0], channels[1]); }
+    static ChannelsState deserialize(const char*& in) {
+        ChannelsState s;
+        decodeFields(in, s.channels[0], s.channels[1]);
+        return s;
+    }
+
+    bool satisfyInvariant() const { return channels[0].size() <= Capacity && channels[1].size() <= Capacity; }
+    bool satisfyConstraint() const { return true; }
+    void generate() {
+        for (auto& channel : channels) {
+            for (uint8_t m = 0; channel.size() < Capacity && m < Values; m++) {
+                this->either([&]() {
+                    channel.push_back(m);
+                }, [&]() {
+                    channel.pop_back();
+                });
+            }
+            if (!channel.empty()) {
+                this->either([&]() { channel.erase(channel.begin()); });
+            }
+        }
+    }
+};
+
+//
+// Clients clients that each acquire up to two of Resources resources at a
+// time and release them in any order. The state is flat, but it defines a
+// compact serialize() with the field codecs, one varint per EnumBitset, which
+// spilled queues, checkpoints and --processes batches use.
+//
+enum BenchResource : uint8_t {};
+
+template <size_t Clients, size_t Resources>
+struct AllocatorState : public ModelState<AllocatorState<Clients, Resources>> {
+    using ResourceSet = EnumBitset<BenchResource, Resources>;
+
+    std::array<ResourceSet, Clients> held = {};
+    ResourceSet free;
+
+    AllocatorState() {
+        for (size_t r = 0; r < Resources; r++) free.set(BenchResource(r));
+    }
+
+    friend bool operator==(const AllocatorState& lhs, const AllocatorState& rhs) {
+        return lhs.held == rhs.held && lhs.free == rhs.free;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const AllocatorState& s) {
+        return H::combine(std::move(h), s.held, s.free);
+    }
+
+    friend std::ostream& operator << (std::ostream &out, const AllocatorState& s) {
+        out << "[held:";
+        for (auto& h : s.held) out << " " << h;
+        return out << ", free: " << s.free << "]";
+    }
+
+    void serialize(std::string& out) const { encodeFields(out, held, free); }
+    static AllocatorState deserialize(const char*& in) {
+        AllocatorState s;
+        decodeFields(in, s.held, s.free);
+        return s;
+    }
+
+    // Every resource is free or held by exactly one client.
+    bool satisfyInvariant() const {
+        uint64_t seen = free.bits();
+        for (auto& h : held) {
+            if (h.bits() & seen) return false;
+            seen |= h.bits();
+        }
+        return seen == (uint64_t(1) << Resources) - 1;
+    }
+    bool satisfyConstraint() const { return true; }
+    void generate() {
+        for (size_t c = 0; c < Clients; c++) {
+            for (size_t r = 0; r < Resources; r++) {
+                auto resource = BenchResource(r);
+                if (held[c].test(resource)) {
+                    this->either([&]() {
+                        held[c].reset(resource);
+                        free.set(resource);
+                    });
+                } else if (free.test(resource) && held[c].count() < 2) {
+                    this->either([&]() {
+                        free.reset(resource);
+                        held[c].set(resource);
+                    });
+                }
+            }
+        }
+    }
+};
+
+//
+// The driver.
+//
+struct BenchResult {
+    uint64_t generated;
+    uint64_t unique;
+    uint64_t seenBytes;
+    double seconds;
+};
+
+template <class StateType>
+BenchResult runModel(const CheckerOptions& options) {
+    auto checker = Checker<StateType>::get();
+    auto start = std::chrono::steady_clock::now();
+    checker->run({StateType()}, options);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto& stats = checker->stats();
+    return BenchResult{stats.generated, stats.unique, stats.seenBytes,
+                       std::chrono::duration<double>(elapsed).count()};
+}
+
+struct BenchModel {
+    std::string name;
+    std::function<BenchResult(const CheckerOptions&)> run;
+};
+
+std::vector<BenchModel> allModels() {
+    return {
+        {"diehard", runModel<DieHardState>},
+        {"mongo_n3_t4_l4", runModel<BenchMongoState<3, 4, 4>>},
+        {"mongo_n3_t5_l5", runModel<BenchMongoState<3, 5, 5>>},
+        {"mongo_n5_t3_l2", runModel<BenchMongoState<5, 3, 2>>},
+        {"wide_6x8", runModel<WideFanoutState<6, 8>>},
+        {"wide_12x3", runModel<WideFanoutState<12, 3>>},
+        {"processes_6x6", runModel<IndependentProcessesState<6, 6>>},
+        {"channels_3x5", runModel<ChannelsState<3, 5>>},
+        {"allocator_4x8", runModel<AllocatorState<4, 8>>},
+        {"channels_3x4", runModel<ChannelsState<3, 4>>},
+        {"allocator_4x6", runModel<AllocatorState<4, 6>>},
+    };
+}
+
+std::vector<std::string> splitList(const char* list) {
+    std::vector<std::string> items;
+    std::stringstream str(list);
+    std::string item;
+    while (std::getline(str, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// Runs the model in a child process. Returns false if the child failed.
+bool runIsolated(const BenchModel& model, const CheckerOptions& options,
+                 BenchResult* result, long* peakRssKb) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << "Cannot create pipe: " << strerror(errno) << std::endl;
+        abort();
+    }
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        // The checker's own messages would interleave with the table.
+        std::cout.setstate(std::ios::failbit);
+        BenchResult r = model.run(options);
+        bool ok = write(fds[1], &r, sizeof(r)) == sizeof(r);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        std::cerr << "Cannot wait for benchmark: " << strerror(errno) << std::endl;
+        abort();
+    }
+    *peakRssKb = usage.ru_maxrss;
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// The runs of --check: every scheduler and seen-set backend, and several
+// processes, all starting from the smallest tables, which grow or spill to
+// disk several times over. Breadth-first runs on one process also write a
+// checkpoint as often as they can, and are resumed from the last one.
+std::vector<std::vector<std::string>> checkRuns() {
+    std::vector<std::vector<std::string>> runs;
+    for (std::string seen : {"memory", "disk", "bitstate"}) {
+        for (std::vector<std::string> run : std::vector<std::vector<std::string>>{
+                 {"--workers=1"},
+                 {"--workers=1", "--queue-memory=4096"},
+                 {"--workers=4", "--scheduler=shared"},
+                 {"--workers=4", "--scheduler=stealing"},
+                 {"--workers=4", "--scheduler=stealing", "--layered"},
+                 {"--workers=4", "--scheduler=levels"},
+                 {"--workers=4", "--deterministic"},
+             }) {
+            run.push_back("--seen=" + seen);
+            run.push_back("--checkpoint-interval=0.001");
+            runs.push_back(run);
+        }
+    }
+    for (std::string seen : {"memory", "disk"}) {
+        runs.push_back({"--processes=2", "--seen=" + seen});
+        runs.push_back({"--processes=3", "--seen=" + seen, "--fingerprints-only"});
+    }
+    for (auto& run : runs) {
+        run.push_back("--seen-capacity=4096");
+    }
+    return runs;
+}
+
+// Runs checkRuns() on every model. A bitstate table may omit states, so
+// bitstate runs only must not find more than one worker does.
+int runChecks(const std::vector<BenchModel>& models, const std::vector<char*>& checkerArgs) {
+    auto optionsOf = [&](const std::vector<std::string>& run) {
+        std::vector<char*> args = checkerArgs;
+        for (auto& arg : run) {
+            args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        CheckerOptions options = CheckerOptions::fromArgs(args.size(), args.data());
+        options.reportInterval = 0;
+        return options;
+    };
+    std::string checkpoint = optionsOf({}).diskDirectory + "/checker_bench_check." + std::to_string(getpid());
+
+    bool failed = false;
+    for (auto& model : models) {
+        BenchResult expected;
+        long peakRssKb = 0;
+        if (!runIsolated(model, optionsOf({"--workers=1"}), &expected, &peakRssKb)) {
+            std::cerr << model.name << " failed on one worker." << std::endl;
+            failed = true;
+            continue;
+        }
+        for (auto& run : checkRuns()) {
+            CheckerOptions options = optionsOf(run);
+            bool resumable = options.processes <= 1;
+            if (resumable) {
+                options.checkpointPath = checkpoint;
+                unlink(checkpoint.c_str());
+            }
+            std::string name;
+            for (auto& arg : run) {
+                name += " " + arg;
+            }
+            auto check = [&](const CheckerOptions& options, const std::string& name) {
+                BenchResult r;
+                bool ok = runIsolated(model, options, &r, &peakRssKb);
+                ok = ok && (options.seenBackend == SeenBackend::Bitstate ? r.unique <= expected.unique
+                                                                         : r.unique == expected.unique);
+                std::cout << (ok ? "ok   " : "FAIL ") << model.name << name << ": " << r.unique
+                          << " unique, expected " << expected.unique << std::endl;
+                failed |= !ok;
+            };
+            check(options, name);
+            if (resumable && access(checkpoint.c_str(), F_OK) == 0) {
+                options.checkpointPath.clear();
+                options.resumePath = checkpoint;
+                check(options, name + " --resume");
+            }
+        }
+    }
+    unlink(checkpoint.c_str());
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    bool checking = false;
+    std::vector<std::string> modelNames;
+    std::vector<size_t> workerCounts = {1, std::max<size_t>(1, std::thread::hardware_concurrency())};
+    std::vector<std::string> backends = {"memory", "disk"};
+    // The lists are ours; the rest goes to every run.
+    std::vector<char*> checkerArgs = {argv[0]};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&](const char* prefix) -> const char* {
+            size_t n = strlen(prefix);
+            return arg.compare(0, n, prefix) == 0 ? argv[i] + n : nullptr;
+        };
+        if (arg == "--check") {
+            checking = true;
+        } else if (auto v = value("--models=")) {
+            modelNames = splitList(v);
+        } else if (auto v = value("--workers=")) {
+            workerCounts.clear();
+            for (auto& n : splitList(v)) {
+                workerCounts.push_back(strtoul(n.c_str(), nullptr, 10));
+            }
+        } else if (auto v = value("--seen=")) {
+            backends = splitList(v);
+            for (auto& backend : backends) {
+                if (backend != "memory" && backend != "disk" && backend != "bitstate") {
+                    std::cerr << "Unknown value in " << arg << "; expected memory, disk or bitstate." << std::endl;
+                    return 1;
+                }
+            }
+        } else {
+            checkerArgs.push_back(argv[i]);
+        }
+    }
+    CheckerOptions base = CheckerOptions::fromArgs(checkerArgs.size(), checkerArgs.data());
+    base.reportInterval = 0;
+    std::sort(workerCounts.begin(), workerCounts.end());
+    workerCounts.erase(std::unique(workerCounts.begin(), workerCounts.end()), workerCounts.end());
+
+    if (checking && modelNames.empty()) {
+        // Small models, flat and not, with one of them the Raft model.
+        modelNames = {"diehard", "mongo_n3_t4_l4", "channels_3x4", "allocator_4x6"};
+    }
+    std::vector<BenchModel> models;
+    for (auto& model : allModels()) {
+        if (modelNames.empty() || std::find(modelNames.begin(), modelNames.end(), model.name) != modelNames.end()) {
+            models.push_back(model);
+        }
+    }
+    if (checking) {
+        return runChecks(models, checkerArgs);
+    }
+
+    bool json = base.reportFormat == ReportFormat::Json;
+    if (!json) {
+        std::cout << std::left << std::setw(16) << "model" << std::setw(10) << "seen" << std::setw(8) << "workers"
+                  << std::right << std::setw(12) << "generated" << std::setw(10) << "unique"
+                  << std::setw(10) << "seconds" << std::setw(12) << "states/sec"
+                  << std::setw(12) << "seen B/st" << std::setw(12) << "rss B/st" << std::setw(10) << "peak MB"
+                  << std::endl;
+    }
+    bool failed = false;
+    for (auto& model : models) {
+        for (auto& backend : backends) {
+            for (size_t workers : workerCounts) {
+                CheckerOptions options = base;
+                options.seenBackend = backend == "disk" ? SeenBackend::Disk
+                                    : backend == "bitstate" ? SeenBackend::Bitstate
+                                    : SeenBackend::Memory;
+                options.workers = workers;
+
+                BenchResult r;
+                long peakRssKb = 0;
+                if (!runIsolated(model, options, &r, &peakRssKb)) {
+                    std::cerr << model.name << " failed with --seen=" << backend << " --workers=" << workers << std::endl;
+                    failed = true;
+                    continue;
+                }
+                uint64_t statesPerSec = r.generated / std::max(r.seconds, 1e-9);
+                uint64_t unique = std::max<uint64_t>(r.unique, 1);
+                uint64_t seenBytesPerState = r.seenBytes / unique;
+                uint64_t rssBytesPerState = peakRssKb * 1024 / unique;
+                if (json) {
+                    std::cout << "{\"model\": \"" << model.name << "\", \"seen\": \"" << backend
+                              << "\", \"workers\": " << options.workers
+                              << ", \"generated\": " << r.generated << ", \"unique\": " << r.unique
+                              << ", \"seconds\": " << r.seconds << ", \"generated_per_sec\": " << statesPerSec
+                              << ", \"seen_bytes_per_state\": " << seenBytesPerState
+                              << ", \"rss_bytes_per_state\": " << rssBytesPerState
+                              << ", \"peak_rss_bytes\": " << peakRssKb * 1024 << "}" << std::endl;
+                } else {
+                    std::cout << std::left << std::setw(16) << model.name << std::setw(10) << backend
+                              << std::setw(8) << options.workers << std::right
+                              << std::setw(12) << r.generated << std::setw(10) << r.unique
+                              << std::setw(10) << std::fixed << std::setprecision(3) << r.seconds
+                              << std::setw(12) << statesPerSec << std::setw(12) << seenBytesPerState
+                              << std::setw(12) << rssBytesPerState << std::setw(10) << peakRssKb / 1024
+                              << std::endl;
+                }
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Checkpoints of a search are one binary file, written and read as a stream
+// through a buffer. Values are stored in the byte order of the machine, so a
+// checkpoint is read back by the same build on the same kind of machine.
+const uint64_t kCheckpointMagic = 0x31544e494f504b43ull;  // "CKPOINT1"
+
+// Writes a checkpoint next to path and moves it over path once it is
+// complete, so path always holds the last complete checkpoint, however the
+// process exits.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const std::string& path) : _path(path), _tempPath(path + ".tmp") {
+        _fd = open(_tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0) {
+            std::cerr << "Cannot create checkpoint " << _tempPath << ": " << strerror(errno) << std::endl;
+            abort();
+        }
+        _buffer.reserve(kBufferBytes);
+    }
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // An uncommitted checkpoint is removed.
+    ~CheckpointWriter() {
+        if (_fd < 0) return;
+        close(_fd);
+        unlink(_tempPath.c_str());
+    }
+
+    void write(const void* data, size_t bytes) {
+        if (_buffer.size() + bytes > kBufferBytes) {
+            flush();
+        }
+        if (bytes >= kBufferBytes) {
+            writeAll(static_cast<const char*>(data), bytes);
+            return;
+        }
+        _buffer.append(static_cast<const char*>(data), bytes);
+    }
+
+    template <class T>
+    void writeValue(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values are written as bytes.");
+        write(&value, sizeof(T));
+    }
+
+    // Bytes prefixed with their length.
+    void writeBytes(const std::string& bytes) {
+        writeValue<uint64_t>(bytes.size());
+        write(bytes.data(), bytes.size());
+    }
+
+    // Syncs the checkpoint to disk and replaces the previous one.
+    void commit() {
+        flush();
+        if (fsync(_fd) != 0 || close(_fd) != 0) {
+            std::cerr << "Cannot write checkpoint " << _tempPath << ": " << strerror(errno) << std::endl;
+            abort();
+        }
+        _fd = -1;
+        if (rename(_tempPath.c_str(), _path.c_str()) != 0) {
+            std::cerr << "Cannot rename checkpoint to " << _path << ": " << strerror(errno) << std::endl;
+            abort();
+        }
+    }
+
+    // Bytes written so far.
+    size_t size() const { return _written + _buffer.size(); }
+
+private:
+    static const size_t kBufferBytes = 1 << 20;
+
+    void flush() {
+        writeAll(_buffer.data(), _buffer.size());
+        _buffer.clear();
+    }
+
+    void writeAll(const char* data, size_t bytes) {
+        _written += bytes;
+        while (bytes > 0) {
+            ssize_t n = ::write(_fd, data, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot write checkpoint " << _tempPath << ": " << strerror(errno) << std::endl;
+                abort();
+            }
+            data += n;
+            bytes -= n;
+        }
+    }
+
+    std::string _path;
+    std::string _tempPath;
+    int _fd = -1;
+    std::string _buffer;
+    size_t _written = 0;
+};
+
+// Reads a checkpoint written by CheckpointWriter, in the same order.
+class CheckpointReader {
+public:
+    explicit CheckpointReader(const std::string& path) : _path(path) {
+        _fd = open(path.c_str(), O_RDONLY);
+        if (_fd < 0) {
+            fail(strerror(errno));
+        }
+        _buffer.resize(kBufferBytes);
+    }
+    CheckpointReader(const CheckpointReader&) = delete;
+    CheckpointReader& operator=(const CheckpointReader&) = delete;
+    ~CheckpointReader() { close(_fd); }
+
+    void read(void* data, size_t bytes) {
+        auto out = static_cast<char*>(data);
+        while (bytes > 0) {
+            if (_pos == _end) {
+                refill();
+            }
+            size_t n = std::min(bytes, _end - _pos);
+            memcpy(out, &_buffer[_pos], n);
+            _pos += n;
+            out += n;
+            bytes -= n;
+        }
+    }
+
+    template <class T>
+    T readValue() {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values are read as bytes.");
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+
+    void readBytes(std::string& bytes) {
+        bytes.resize(readValue<uint64_t>());
+        if (!bytes.empty()) read(&bytes[0], bytes.size());
+    }
+
+    // Stops the run: the checkpoint cannot be resumed.
+    [[noreturn]] void fail(const std::string& why) const {
+        std::cerr << "Cannot resume from " << _path << ": " << why << std::endl;
+        abort();
+    }
+
+private:
+    static const size_t kBufferBytes = 1 << 20;
+
+    void refill() {
+        ssize_t n;
+        do {
+            n = ::read(_fd, &_buffer[0], _buffer.size());
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) fail(strerror(errno));
+        if (n == 0) fail("the checkpoint is truncated");
+        _pos = 0;
+        _end = n;
+    }
+
+    std::string _path;
+    int _fd = -1;
+    std::string _buffer;
+    size_t _pos = 0;
+    size_t _end = 0;
+};
@@ -74,12 +74,12 @@ void State::generate() {
     });
 }
 
-int main(int argv, char** argc) {
+int main(int argc, char** argv) {
     State initialState;
     initialState.big = 0;
     initialState.small = 0;
 
-    Checker<State>::get()->run({initialState});
+    Checker<State>::get()->run({initialState}, CheckerOptions::fromArgs(argc, argv));
 
     return 0;
 }
@@ -0,0 +1,758 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+// Fingerprints are 64 bits, or 128 bits when built with
+// CHECKER_FINGERPRINT_128. With n distinct states the chance that two of
+// them share a fingerprint grows as n^2 / 2^bits: 64 bits are plenty for
+// 10^8 states but not for 10^10. 128-bit fingerprints double the size of
+// the seen table.
+#ifdef CHECKER_FINGERPRINT_128
+using Fingerprint = unsigned __int128;
+const int kFingerprintBits = 128;
+
+inline std::ostream& operator<<(std::ostream& out, unsigned __int128 fp) {
+    char digits[33];
+    snprintf(digits, sizeof(digits), "%016llx%016llx",
+             (unsigned long long)(fp >> 64), (unsigned long long)fp);
+    return out << digits;
+}
+#else
+using Fingerprint = uint64_t;
+const int kFingerprintBits = 64;
+#endif
+
+// The low 64 bits mixed with the high ones, for hash tables and seeds.
+inline uint64_t foldFingerprint(Fingerprint fp) {
+    return uint64_t(fp) ^ uint64_t(fp >> (kFingerprintBits / 2) >> (kFingerprintBits / 2));
+}
+
+// Tables use 0 to mark an empty slot, so the (unlikely) fingerprint 0 is
+// stored under the key of 1.
+inline Fingerprint fingerprintKey(Fingerprint fp) { return fp == 0 ? 1 : fp; }
+
+// The set of fingerprints the checker has seen. Every fingerprint carries the
+// fingerprint of the state it was first reached from (0 for initial states),
+// so error traces can be walked backwards. Implementations are thread-safe
+// except where noted.
+class FingerprintSet {
+public:
+    virtual ~FingerprintSet() {}
+
+    // Adds fp if it is absent. Returns true if this call added it.
+    virtual bool insert(Fingerprint fp, Fingerprint parent) = 0;
+
+    // Adds n fingerprints at once and sets inserted[i] for the ones that were
+    // absent. A fingerprint repeated within the batch is added by its first
+    // occurrence. While one fingerprint is inserted, the memory of the one
+    // kPrefetchDistance ahead is already on its way into the cache, so on a
+    // table much larger than the cache the misses of a batch overlap.
+    virtual void insertBatch(size_t n, const Fingerprint* fps, const Fingerprint* parents, bool* inserted) {
+        for (size_t i = 0; i < n && i < kPrefetchDistance; i++) {
+            prefetch(fps[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (i + kPrefetchDistance < n) {
+                prefetch(fps[i + kPrefetchDistance]);
+            }
+            inserted[i] = insert(fps[i], parents[i]);
+        }
+    }
+
+    // Hints that fp is about to be inserted. Must not change the set.
+    virtual void prefetch(Fingerprint) const {}
+
+    // Looks up fp and stores the fingerprint it was first reached from in *parent.
+    virtual bool find(Fingerprint fp, Fingerprint* parent) const = 0;
+
+    // Whether the set would like grow() to be called.
+    virtual bool needsGrow() const { return false; }
+    // Not thread-safe: no other thread may use the set meanwhile.
+    virtual void grow() {}
+
+    virtual size_t size() const = 0;
+    virtual size_t memoryBytes() const = 0;
+
+    // Whether find() can walk parent links. Without them there are no traces.
+    virtual bool keepsParents() const { return true; }
+    // A line on the state of the set for the end of a run, if it has one.
+    virtual std::string report() const { return ""; }
+
+    // Writes the set to a checkpoint, and reads it back into a new set made
+    // with the same options. Not thread-safe.
+    virtual void save(CheckpointWriter& out) const = 0;
+    virtual void load(CheckpointReader& in) = 0;
+
+protected:
+    static const uint64_t kEmpty = 0;
+    static const size_t kPrefetchDistance = 8;
+};
+
+// An open-addressing table of fingerprints that many threads can insert into
+// without taking a lock. Slots are claimed with a single CAS on the key and
+// never freed. Growing the table is not lock-free; the checker calls grow()
+// between expansions once every worker is idle.
+class ConcurrentFingerprintSet : public FingerprintSet {
+public:
+    // The capacity is rounded up to a power of two.
+    explicit ConcurrentFingerprintSet(size_t capacity = 1 << 20) {
+        size_t slots = 16;
+        while (slots < capacity) slots <<= 1;
+        _slots.reset(new Slot[slots]);
+        _mask = slots - 1;
+    }
+
+    bool insert(Fingerprint fp, Fingerprint parent) override {
+        fp = fingerprintKey(fp);
+        size_t probes = 0;
+        for (size_t i = fp & _mask;; i = (i + 1) & _mask) {
+            auto& slot = _slots[i];
+            Fingerprint key = slot.key.load(std::memory_order_acquire);
+            if (key == kEmpty) {
+                if (slot.key.compare_exchange_strong(key, fp, std::memory_order_acq_rel)) {
+                    slot.parent.store(parent, std::memory_order_release);
+                    _size.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                // Lost the race; key now holds the winner's fingerprint.
+            }
+            if (key == fp) return false;
+            if (++probes > _mask) {
+                std::cerr << "Fingerprint table is full." << std::endl;
+                abort();
+            }
+        }
+    }
+
+    // The first slot probed, which usually holds fp or is empty.
+    void prefetch(Fingerprint fp) const override {
+        __builtin_prefetch(&_slots[fingerprintKey(fp) & _mask], 1);
+    }
+
+    bool find(Fingerprint fp, Fingerprint* parent) const override {
+        fp = fingerprintKey(fp);
+        for (size_t i = fp & _mask, probes = 0; probes <= _mask; i = (i + 1) & _mask, probes++) {
+            auto& slot = _slots[i];
+            Fingerprint key = slot.key.load(std::memory_order_acquire);
+            if (key == kEmpty) return false;
+            if (key == fp) {
+                *parent = slot.parent.load(std::memory_order_acquire);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Linear probing degrades quickly past half full.
+    bool needsGrow() const override { return size() * 2 > capacity(); }
+
+    // Doubles the table.
+    void grow() override {
+        std::unique_ptr<Slot[]> old(std::move(_slots));
+        size_t oldCapacity = capacity();
+        _slots.reset(new Slot[oldCapacity * 2]);
+        _mask = oldCapacity * 2 - 1;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            Fingerprint key = old[i].key.load(std::memory_order_relaxed);
+            if (key == kEmpty) continue;
+            size_t j = key & _mask;
+            while (_slots[j].key.load(std::memory_order_relaxed) != kEmpty) {
+                j = (j + 1) & _mask;
+            }
+            _slots[j].key.store(key, std::memory_order_relaxed);
+            _slots[j].parent.store(old[i].parent.load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+        }
+    }
+
+    size_t size() const override { return _size.load(std::memory_order_relaxed); }
+    size_t capacity() const { return _mask + 1; }
+    size_t memoryBytes() const override { return capacity() * sizeof(Slot); }
+
+    void save(CheckpointWriter& out) const override {
+        out.writeValue<uint64_t>(size());
+        for (size_t i = 0; i < capacity(); i++) {
+            Fingerprint key = _slots[i].key.load(std::memory_order_relaxed);
+            if (key == kEmpty) continue;
+            out.writeValue(key);
+            out.writeValue(_slots[i].parent.load(std::memory_order_relaxed));
+        }
+    }
+
+    void load(CheckpointReader& in) override {
+        uint64_t n = in.readValue<uint64_t>();
+        while (n * 2 > capacity()) grow();
+        for (uint64_t i = 0; i < n; i++) {
+            Fingerprint key = in.readValue<Fingerprint>();
+            insert(key, in.readValue<Fingerprint>());
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<Fingerprint> key{kEmpty};
+        std::atomic<Fingerprint> parent{0};
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    size_t _mask = 0;
+    std::atomic<size_t> _size{0};
+};
+
+// A fingerprint set for state spaces that do not fit in memory, after TLC's
+// DiskFPSet. New fingerprints go to a bounded in-memory table. When the table
+// fills up, its entries are sorted and written out as a run file, and runs
+// are merged once there are too many of them. A lookup checks the table and
+// then every run, each through a sparse in-memory index of its blocks.
+//
+// The set is split into partitions by the top bits of the fingerprint, each
+// with its own lock, table and runs. Batches are probed in sorted order so
+// every block of a run is read at most once per batch.
+class DiskFingerprintSet : public FingerprintSet {
+public:
+    // Keeps at most about memoryEntries fingerprints in memory and spills the
+    // rest to files under directory. The files are unlinked as soon as they
+    // are created, so nothing is left behind however the process exits.
+    DiskFingerprintSet(const std::string& directory, size_t memoryEntries)
+            : _directory(directory) {
+        _partitionLimit = std::max<size_t>(1, memoryEntries / kPartitions);
+        size_t slots = 16;
+        while (slots < _partitionLimit * 2) slots <<= 1;
+        for (auto& part : _partitions) {
+            part.table.assign(slots, Entry{kEmpty, 0});
+        }
+    }
+
+    ~DiskFingerprintSet() override {
+        for (auto& part : _partitions) {
+            for (auto& run : part.runs) {
+                removeRun(run);
+            }
+        }
+    }
+
+    bool insert(Fingerprint fp, Fingerprint parent) override {
+        bool inserted;
+        insertBatch(1, &fp, &parent, &inserted);
+        return inserted;
+    }
+
+    void insertBatch(size_t n, const Fingerprint* fps, const Fingerprint* parents, bool* inserted) override {
+        // A stable sort keeps the first occurrence of a repeated fingerprint first.
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return fingerprintKey(fps[a]) < fingerprintKey(fps[b]);
+        });
+
+        // Sorted fingerprints are grouped by partition.
+        for (size_t i = 0; i < n;) {
+            auto& part = _partitions[partitionOf(fingerprintKey(fps[order[i]]))];
+            std::lock_guard<std::mutex> lk(part.mutex);
+            auto cursors = cursorsFor(part);
+            for (; i < n && &_partitions[partitionOf(fingerprintKey(fps[order[i]]))] == &part; i++) {
+                size_t k = order[i];
+                Fingerprint fp = fingerprintKey(fps[k]);
+                Fingerprint parent;
+                if (findLocked(part, cursors, fp, &parent)) {
+                    inserted[k] = false;
+                    continue;
+                }
+                insertLocked(part, fp, parents[k]);
+                _size.fetch_add(1, std::memory_order_relaxed);
+                inserted[k] = true;
+                if (part.count >= _partitionLimit) {
+                    flush(part);
+                    cursors = cursorsFor(part);
+                }
+            }
+        }
+    }
+
+    bool find(Fingerprint fp, Fingerprint* parent) const override {
+        fp = fingerprintKey(fp);
+        auto& part = _partitions[partitionOf(fp)];
+        std::lock_guard<std::mutex> lk(part.mutex);
+        auto cursors = cursorsFor(part);
+        return findLocked(part, cursors, fp, parent);
+    }
+
+    size_t size() const override { return _size.load(std::memory_order_relaxed); }
+
+    size_t memoryBytes() const override {
+        size_t bytes = 0;
+        for (auto& part : _partitions) {
+            std::lock_guard<std::mutex> lk(part.mutex);
+            bytes += part.table.size() * sizeof(Entry);
+            for (auto& run : part.runs) {
+                bytes += run.index.size() * sizeof(Fingerprint);
+            }
+        }
+        return bytes;
+    }
+
+    // Entries are written in no particular order, partition by partition.
+    void save(CheckpointWriter& out) const override {
+        out.writeValue<uint64_t>(size());
+        std::vector<Entry> buffer;
+        for (auto& part : _partitions) {
+            std::lock_guard<std::mutex> lk(part.mutex);
+            for (auto& e : part.table) {
+                if (e.fp != kEmpty) out.writeValue(e);
+            }
+            for (auto& run : part.runs) {
+                for (size_t first = 0; first < run.entries; first += buffer.size()) {
+                    buffer.resize(std::min(run.entries - first, size_t(kMergeBufferEntries)));
+                    readAll(run.fd, buffer.data(), buffer.size() * sizeof(Entry), first * sizeof(Entry));
+                    out.write(buffer.data(), buffer.size() * sizeof(Entry));
+                }
+            }
+        }
+    }
+
+    // Spills to new runs as the entries come in, like any other inserts.
+    void load(CheckpointReader& in) override {
+        uint64_t n = in.readValue<uint64_t>();
+        std::vector<Fingerprint> fps, parents;
+        std::unique_ptr<bool[]> inserted(new bool[kMergeBufferEntries]);
+        while (n > 0) {
+            size_t batch = std::min<uint64_t>(n, kMergeBufferEntries);
+            fps.resize(batch);
+            parents.resize(batch);
+            for (size_t i = 0; i < batch; i++) {
+                Entry e = in.readValue<Entry>();
+                fps[i] = e.fp;
+                parents[i] = e.parent;
+            }
+            insertBatch(batch, fps.data(), parents.data(), inserted.get());
+            n -= batch;
+        }
+    }
+
+    // Number of fingerprints written to run files.
+    size_t diskEntries() const {
+        size_t entries = 0;
+        for (auto& part : _partitions) {
+            std::lock_guard<std::mutex> lk(part.mutex);
+            for (auto& run : part.runs) {
+                entries += run.entries;
+            }
+        }
+        return entries;
+    }
+
+private:
+    struct Entry {
+        Fingerprint fp;
+        Fingerprint parent;
+    };
+
+    static const size_t kPartitionBits = 4;
+    static const size_t kPartitions = 1 << kPartitionBits;
+    // 8KB blocks: one pread per probe of a run.
+    static const size_t kBlockEntries = 512;
+    // Merging keeps the number of reads per lookup bounded.
+    static const size_t kMaxRuns = 8;
+    static const size_t kMergeBufferEntries = 1 << 16;
+
+    struct Run {
+        std::string path;
+        int fd = -1;
+        size_t entries = 0;
+        // The first fingerprint of every block.
+        std::vector<Fingerprint> index;
+    };
+
+    // Reads the blocks of one run in increasing order, caching the last one.
+    struct RunCursor {
+        const Run* run;
+        size_t block = SIZE_MAX;
+        std::vector<Entry> entries;
+
+        bool find(Fingerprint fp, Fingerprint* parent) {
+            auto it = std::upper_bound(run->index.begin(), run->index.end(), fp);
+            if (it == run->index.begin()) return false;
+            size_t b = it - run->index.begin() - 1;
+            if (b != block) {
+                size_t first = b * kBlockEntries;
+                entries.resize(std::min(run->entries - first, size_t(kBlockEntries)));
+                readAll(run->fd, entries.data(), entries.size() * sizeof(Entry), first * sizeof(Entry));
+                block = b;
+            }
+            auto e = std::lower_bound(entries.begin(), entries.end(), fp, [](const Entry& e, Fingerprint fp) {
+                return e.fp < fp;
+            });
+            if (e == entries.end() || e->fp != fp) return false;
+            *parent = e->parent;
+            return true;
+        }
+    };
+
+    struct Partition {
+        mutable std::mutex mutex;
+        // Open addressing over the fingerprints not yet flushed.
+        std::vector<Entry> table;
+        size_t count = 0;
+        std::vector<Run> runs;
+    };
+
+    static size_t partitionOf(Fingerprint key) { return key >> (kFingerprintBits - kPartitionBits); }
+
+    static std::vector<RunCursor> cursorsFor(const Partition& part) {
+        std::vector<RunCursor> cursors;
+        for (auto& run : part.runs) {
+            cursors.push_back(RunCursor{&run, SIZE_MAX, {}});
+        }
+        return cursors;
+    }
+
+    static bool findLocked(const Partition& part, std::vector<RunCursor>& cursors,
+                           Fingerprint fp, Fingerprint* parent) {
+        size_t mask = part.table.size() - 1;
+        for (size_t i = fp & mask; part.table[i].fp != kEmpty; i = (i + 1) & mask) {
+            if (part.table[i].fp == fp) {
+                *parent = part.table[i].parent;
+                return true;
+            }
+        }
+        for (auto& cursor : cursors) {
+            if (cursor.find(fp, parent)) return true;
+        }
+        return false;
+    }
+
+    static void insertLocked(Partition& part, Fingerprint fp, Fingerprint parent) {
+        size_t mask = part.table.size() - 1;
+        size_t i = fp & mask;
+        while (part.table[i].fp != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        part.table[i] = Entry{fp, parent};
+        part.count++;
+    }
+
+    // Writes the in-memory table of the partition out as a new sorted run.
+    void flush(Partition& part) {
+        std::vector<Entry> entries;
+        entries.reserve(part.count);
+        for (auto& e : part.table) {
+            if (e.fp != kEmpty) entries.push_back(e);
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.fp < b.fp;
+        });
+        std::fill(part.table.begin(), part.table.end(), Entry{kEmpty, 0});
+        part.count = 0;
+
+        Run run = createRun();
+        appendToRun(run, entries.data(), entries.size());
+        part.runs.push_back(std::move(run));
+        if (part.runs.size() > kMaxRuns) {
+            merge(part);
+        }
+    }
+
+    // Merges all runs of the partition into one.
+    void merge(Partition& part) {
+        // Reads one run sequentially through a buffer.
+        struct Reader {
+            const Run* run;
+            size_t next = 0;
+            size_t pos = 0;
+            std::vector<Entry> buffer;
+
+            bool done() const { return pos == buffer.size() && next == run->entries; }
+            const Entry& head() {
+                if (pos == buffer.size()) {
+                    buffer.resize(std::min(run->entries - next, size_t(kMergeBufferEntries)));
+                    readAll(run->fd, buffer.data(), buffer.size() * sizeof(Entry), next * sizeof(Entry));
+                    next += buffer.size();
+                    pos = 0;
+                }
+                return buffer[pos];
+            }
+        };
+
+        std::vector<Reader> readers;
+        for (auto& run : part.runs) {
+            readers.push_back(Reader{&run, 0, 0, {}});
+        }
+        Run merged = createRun();
+        std::vector<Entry> out;
+        while (true) {
+            Reader* min = nullptr;
+            for (auto& r : readers) {
+                if (!r.done() && (!min || r.head().fp < min->head().fp)) min = &r;
+            }
+            if (!min) break;
+            out.push_back(min->head());
+            min->pos++;
+            if (out.size() == kMergeBufferEntries) {
+                appendToRun(merged, out.data(), out.size());
+                out.clear();
+            }
+        }
+        appendToRun(merged, out.data(), out.size());
+
+        for (auto& run : part.runs) {
+            removeRun(run);
+        }
+        part.runs.clear();
+        part.runs.push_back(std::move(merged));
+    }
+
+    Run createRun() {
+        Run run;
+        run.path = _directory + "/checker-" + std::to_string(getpid()) + "-" +
+                   std::to_string(_nextRunId.fetch_add(1)) + ".fp";
+        run.fd = open(run.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (run.fd < 0) {
+            std::cerr << "Cannot create fingerprint run " << run.path << ": " << strerror(errno) << std::endl;
+            abort();
+        }
+        unlink(run.path.c_str());
+        return run;
+    }
+
+    static void appendToRun(Run& run, const Entry* entries, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            if ((run.entries + i) % kBlockEntries == 0) {
+                run.index.push_back(entries[i].fp);
+            }
+        }
+        writeAll(run.fd, entries, n * sizeof(Entry), run.entries * sizeof(Entry));
+        run.entries += n;
+    }
+
+    static void removeRun(Run& run) {
+        close(run.fd);
+    }
+
+    static void writeAll(int fd, const void* data, size_t bytes, size_t offset) {
+        auto p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = pwrite(fd, p, bytes, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot write fingerprint run: " << strerror(errno) << std::endl;
+                abort();
+            }
+            p += n;
+            bytes -= n;
+            offset += n;
+        }
+    }
+
+    static void readAll(int fd, void* data, size_t bytes, size_t offset) {
+        auto p = static_cast<char*>(data);
+        while (bytes > 0) {
+            ssize_t n = pread(fd, p, bytes, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot read fingerprint run: " << strerror(errno) << std::endl;
+                abort();
+            }
+            p += n;
+            bytes -= n;
+            offset += n;
+        }
+    }
+
+    std::string _directory;
+    size_t _partitionLimit;
+    std::array<Partition, kPartitions> _partitions;
+    std::atomic<size_t> _size{0};
+    std::atomic<size_t> _nextRunId{0};
+};
+
+// A Bloom filter over state hashes ("bitstate hashing"): each state sets
+// `hashes` bits of a table of `bytes` bytes, and there are no parents. A new
+// state whose bits were all set by others is taken as seen and omitted from
+// the search; a seen state is never taken as new. The filter is blocked: all
+// bits of a state lie in one 64-bit word and are set with one atomic OR, so
+// of several threads inserting the same state at once exactly one takes it
+// as new. It costs a little accuracy for the same memory, which the estimate
+// of omissions accounts for.
+class BitstateTable {
+public:
+    BitstateTable(size_t bytes, unsigned hashes) : _hashes(std::min(64u, std::max(1u, hashes))) {
+        size_t words = 1;
+        while (words * sizeof(uint64_t) < bytes) words <<= 1;
+        _words.reset(new std::atomic<uint64_t>[words]());
+        _wordCount = words;
+    }
+
+    // Sets the bits of hash. Returns true if any of them was clear.
+    bool insert(uint64_t hash) {
+        auto& word = _words[hash & (_wordCount - 1)];
+        uint64_t bits = bitsOf(hash);
+        // The bits of a seen state are set already; only new ones pay for the atomic OR.
+        if ((word.load(std::memory_order_relaxed) & bits) == bits) return false;
+        return (word.fetch_or(bits, std::memory_order_relaxed) & bits) != bits;
+    }
+
+    // Fetches the word insert(hash) reads.
+    void prefetch(uint64_t hash) const {
+        __builtin_prefetch(&_words[hash & (_wordCount - 1)], 1);
+    }
+
+    unsigned hashes() const { return _hashes; }
+    size_t bits() const { return _wordCount * 64; }
+
+    void save(CheckpointWriter& out) const {
+        out.writeValue<uint64_t>(_wordCount);
+        out.writeValue(_hashes);
+        std::vector<uint64_t> words(std::min<size_t>(_wordCount, 1 << 16));
+        for (size_t first = 0; first < _wordCount; first += words.size()) {
+            for (size_t i = 0; i < words.size(); i++) {
+                words[i] = _words[first + i].load(std::memory_order_relaxed);
+            }
+            out.write(words.data(), words.size() * sizeof(uint64_t));
+        }
+    }
+
+    // Reads a table saved with the same size and number of hashes.
+    void load(CheckpointReader& in) {
+        if (in.readValue<uint64_t>() != _wordCount || in.readValue<unsigned>() != _hashes) {
+            in.fail("the bitstate table was saved with other --bitstate-bytes or --bitstate-hashes");
+        }
+        std::vector<uint64_t> words(std::min<size_t>(_wordCount, 1 << 16));
+        for (size_t first = 0; first < _wordCount; first += words.size()) {
+            in.read(words.data(), words.size() * sizeof(uint64_t));
+            for (size_t i = 0; i < words.size(); i++) {
+                _words[first + i].store(words[i], std::memory_order_relaxed);
+            }
+        }
+    }
+    size_t memoryBytes() const { return _wordCount * sizeof(uint64_t); }
+
+    // The fraction of bits set.
+    double fill() const {
+        size_t set = 0;
+        for (size_t i = 0; i < _wordCount; i++) {
+            set += __builtin_popcountll(_words[i].load(std::memory_order_relaxed));
+        }
+        return double(set) / bits();
+    }
+
+    // The expected number of states omitted while inserting n new ones. The
+    // i-th lands in a word that holds j of the others with probability
+    // Poisson(j; i / w), for w words, and is omitted if those set all its k
+    // bits. By inclusion-exclusion over the t of its bits that none of them
+    // sets, that is the sum of (-1)^t C(k, t) q_t^j, where q_t = C(64 - t, k)
+    // / C(64, k) is the chance that one state misses t given bits. The sum
+    // over i is taken as an integral.
+    double expectedOmissions(size_t n) const {
+        const int kSteps = 1024;
+        std::vector<double> terms(_hashes + 1), misses(_hashes + 1);
+        double binomial = 1;
+        for (unsigned t = 0; t <= _hashes; t++) {
+            terms[t] = t % 2 == 0 ? binomial : -binomial;
+            binomial = binomial * (_hashes - t) / (t + 1);
+            misses[t] = 1;
+            for (unsigned i = 0; i < _hashes; i++) {
+                misses[t] *= std::max(0.0, double(64 - t - i)) / (64 - i);
+            }
+        }
+        double sum = 0;
+        for (int step = 0; step < kSteps; step++) {
+            double lambda = (step + 0.5) * n / kSteps / _wordCount;
+            // Poisson terms past the mean by many deviations add nothing.
+            size_t last = size_t(lambda + 12 * std::sqrt(lambda) + 12);
+            double poisson = std::exp(-lambda);
+            for (size_t j = 1; j <= last; j++) {
+                poisson *= lambda / j;
+                double covered = 0;
+                for (unsigned t = 0; t <= _hashes; t++) {
+                    covered += terms[t] * std::pow(misses[t], j);
+                }
+                sum += poisson * std::min(1.0, std::max(0.0, covered));
+            }
+        }
+        return sum * n / kSteps;
+    }
+
+private:
+    // k distinct bits of a word, from 6-bit pieces of the hash mixed with
+    // splitmix64, so that they do not follow the bits that pick the word.
+    // Double hashing within a word would allow only 64 * 32 patterns.
+    uint64_t bitsOf(uint64_t hash) const {
+        uint64_t bits = 0;
+        for (unsigned set = 0; set < _hashes;) {
+            hash += 0x9e3779b97f4a7c15ull;
+            uint64_t z = hash;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            for (int piece = 0; piece < 10 && set < _hashes; piece++, z >>= 6) {
+                uint64_t bit = uint64_t(1) << (z & 63);
+                set += (bits & bit) == 0;
+                bits |= bit;
+            }
+        }
+        return bits;
+    }
+
+    unsigned _hashes;
+    size_t _wordCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> _words;
+};
+
+// Bitstate hashing as the seen set of a whole run: a fixed memory budget
+// for any number of states, at the cost of omitting some of them and of
+// having no parent links for traces.
+class BitstateFingerprintSet : public FingerprintSet {
+public:
+    BitstateFingerprintSet(size_t bytes, unsigned hashes) : _table(bytes, hashes) {}
+
+    bool insert(Fingerprint fp, Fingerprint) override {
+        if (!_table.insert(foldFingerprint(fp))) return false;
+        _size.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    void prefetch(Fingerprint fp) const override { _table.prefetch(foldFingerprint(fp)); }
+    bool find(Fingerprint, Fingerprint*) const override { return false; }
+
+    size_t size() const override { return _size.load(std::memory_order_relaxed); }
+    size_t memoryBytes() const override { return _table.memoryBytes(); }
+    bool keepsParents() const override { return false; }
+
+    void save(CheckpointWriter& out) const override {
+        out.writeValue<uint64_t>(size());
+        _table.save(out);
+    }
+    void load(CheckpointReader& in) override {
+        _size = in.readValue<uint64_t>();
+        _table.load(in);
+    }
+
+    std::string report() const override {
+        double omissions = _table.expectedOmissions(size());
+        std::ostringstream out;
+        out << "Bitstate: " << _table.bits() << " bits, " << _table.hashes() << " hashes, "
+            << 100 * _table.fill() << "% set. Expected omitted states: " << omissions
+            << ", probability of any omission: " << 100 * -std::expm1(-omissions) << "%.";
+        return out.str();
+    }
+
+private:
+    BitstateTable _table;
+    std::atomic<size_t> _size{0};
+};
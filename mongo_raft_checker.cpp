@@ -6,35 +6,26 @@
 
 #include "checker.h"
 #include <vector>
-#include <thread>
-#include <chrono>
-#include <mutex>
-#include <condition_variable>
-
-using namespace std::chrono_literals;
 
 //
 // Define the state.
 //
+const int MAX_TERM = 4;
+const int MAX_LOG_SIZE = 4;
+
 using TermType = uint8_t;
-enum RaftState { Primary, Secondary };
-enum Node { N1, N2, N3, ALL_NODES };
+enum RaftState : uint8_t { Primary, Secondary };
+enum Node : uint8_t { N1, N2, N3, ALL_NODES };
 using LogEntry = TermType;
-using Log = std::vector<LogEntry>;
+// A log may grow one entry past MAX_LOG_SIZE before the constraint prunes the state.
+using Log = BoundedVector<LogEntry, MAX_LOG_SIZE + 1>;
+using Logs = BoundedSequences<LogEntry, ALL_NODES, MAX_LOG_SIZE + 1>;
+using RaftStates = BoundedVector<RaftState, ALL_NODES>;
 std::vector<Node> all_nodes = {N1, N2, N3};
 
 std::ostream& operator << (std::ostream &out, const TermType& v) {
     return out << (uint)v;
 }
-template <class T>
-std::ostream& operator << (std::ostream &out, const std::vector<T>& v) {
-    out << "[";
-    for (auto& e : v) {
-        out << e << (&e == &v.back() ? "" : ",");
-    }
-    out << "]";
-    return out;
-}
 
 std::ostream& operator << (std::ostream &out, const RaftState state) {
     switch (state) {
@@ -46,9 +37,9 @@ std::ostream& operator << (std::ostream &out, const RaftState state) {
 struct MongoState : public ModelState<MongoState> {
     TermType globalCurrentTerm = 0;
 
-    std::vector<RaftState> states{ALL_NODES, Secondary};
+    RaftStates states = RaftStates(ALL_NODES, Secondary);
 
-    std::vector<Log> logs{ALL_NODES, Log()};
+    Logs logs = Logs(ALL_NODES, Log());
 
     friend bool operator==(const MongoState& lhs, const MongoState& rhs) {
         return lhs.globalCurrentTerm == rhs.globalCurrentTerm
@@ -56,12 +47,22 @@ struct MongoState : public ModelState<MongoState> {
             && lhs.logs == rhs.logs;
     }
 
-    // TODO: Symmetry.
     template <typename H>
     friend H AbslHashValue(H h, const MongoState& s) {
         return H::combine(std::move(h), s.globalCurrentTerm, s.states, s.logs);
     }
 
+    // Nodes are interchangeable: each owns its state and log, and no field
+    // refers to another node by id.
+    static const size_t kSymmetricIndices = ALL_NODES;
+    bool symmetricLess(size_t a, size_t b) const {
+        return states[a] != states[b] ? states[a] < states[b] : logs[a] < logs[b];
+    }
+    void permute(const Permutation<ALL_NODES>& p) {
+        p.apply(states);
+        p.apply(logs);
+    }
+
     friend std::ostream& operator << (std::ostream &out, const MongoState& s) {
         return out << " [globalCurrentTerm: " << s.globalCurrentTerm
                    << ", states: " << s.states  << ", logs: " << s.logs << "]";
@@ -70,11 +71,9 @@ struct MongoState : public ModelState<MongoState> {
     bool satisfyConstraint() const;
     void generate();
 };
+static_assert(std::is_trivially_copyable<MongoState>::value, "MongoState should stay flat.");
 
 bool MongoState::satisfyConstraint() const {
-    const int MAX_TERM = 4;
-    const int MAX_LOG_SIZE = 4;
-
     if (globalCurrentTerm > MAX_TERM) return false;
     return std::all_of(logs.begin(), logs.end(), [&](const Log& log){
         return log.size() <= MAX_LOG_SIZE;
@@ -91,7 +90,7 @@ bool CanRollbackOplog(const Log& rlog, const Log& slog) {
         && (rlog.size() > slog.size() || slog[rlog.size() - 1] != rlog.back());
 }
 
-bool RollbackCommitted(const std::vector<Log>& logs, TermType globalTerm, Node me) {
+bool RollbackCommitted(const Logs& logs, TermType globalTerm, Node me) {
     if (logs[me].empty()) return false;
 
     // Commenting out this line will reproduce SERVER-22136.
@@ -135,14 +134,19 @@ void MongoState::generate() {
         if (rlog.empty() || (slog[rlog.size() - 1] == rlog.back())) {
             either([&]() {
                 rlog.push_back(slog[rlog.size()]);
+            }, [&]() {
+                rlog.pop_back();
             });
         }
     };
     // Rollback
     auto RollbackOplog = [&](Node receiver, Node sender) {
         if (!CanRollbackOplog(logs[receiver], logs[sender])) return;
+        LogEntry last = logs[receiver].back();
         either([&](){
             logs[receiver].pop_back();
+        }, [&]() {
+            logs[receiver].push_back(last);
         });
     };
 
@@ -176,34 +180,16 @@ void MongoState::generate() {
         if (states[n] == Primary) {
             either([&]() {
                 logs[n].push_back({globalCurrentTerm});
+            }, [&]() {
+                logs[n].pop_back();
             });
         }
     }
 }
 
-int main(int argv, char** argc) {
+int main(int argc, char** argv) {
     MongoState initialState;
 
-    std::mutex finish_mutex;
-    std::condition_variable finish_cv;
-    bool finished = false;
-
-    std::thread reportingThread([&](){
-        std::unique_lock<std::mutex> lk(finish_mutex);
-        while (!finished) {
-            // std::this_thread::sleep_for(std::chrono::seconds(1));
-            finish_cv.wait_for(lk, 1s);
-            std::cout << Checker<MongoState>::get()->getStats() << std::endl;
-        }
-    });
-
-    Checker<MongoState>::get()->run({initialState});
-    {
-      std::unique_lock<std::mutex> lk(finish_mutex);
-      finished = true;
-      finish_cv.notify_all();
-    }
-
-    reportingThread.join();
+    Checker<MongoState>::get()->run({initialState}, CheckerOptions::fromArgs(argc, argv));
     return 0;
 }
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A group of processes on one machine, every pair connected by a Unix
+// socket. The constructor forks the others from the calling process, which
+// becomes rank 0. Messages are a type byte and a payload, and arrive in the
+// order each sender sent them. Sends are buffered and written as the sockets
+// accept them, so two processes sending to each other never block each
+// other. Not thread-safe.
+class ProcessMesh {
+public:
+    struct Message {
+        size_t from;
+        uint8_t type;
+        std::string payload;
+    };
+
+    explicit ProcessMesh(size_t processes) : _peers(processes) {
+        // links[i][j] is the end of the socket between i and j that i uses.
+        std::vector<std::vector<int>> links(processes, std::vector<int>(processes, -1));
+        for (size_t i = 0; i < processes; i++) {
+            for (size_t j = i + 1; j < processes; j++) {
+                int fds[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                    std::cerr << "Cannot create a socket pair: " << strerror(errno) << std::endl;
+                    abort();
+                }
+                links[i][j] = fds[0];
+                links[j][i] = fds[1];
+            }
+        }
+        // Whatever is buffered would otherwise be printed once per process.
+        std::cout << std::flush;
+        std::cerr << std::flush;
+        fflush(nullptr);
+        for (size_t r = 1; r < processes; r++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                std::cerr << "Cannot fork a checker process: " << strerror(errno) << std::endl;
+                abort();
+            }
+            if (pid == 0) {
+                _rank = r;
+                _children.clear();
+                break;
+            }
+            _children.push_back(pid);
+        }
+        for (size_t i = 0; i < processes; i++) {
+            for (size_t j = 0; j < processes; j++) {
+                if (i != _rank && links[i][j] >= 0) close(links[i][j]);
+            }
+        }
+        for (size_t j = 0; j < processes; j++) {
+            _peers[j].fd = links[_rank][j];
+            if (_peers[j].fd >= 0) {
+                fcntl(_peers[j].fd, F_SETFL, fcntl(_peers[j].fd, F_GETFL) | O_NONBLOCK);
+            }
+        }
+    }
+    ProcessMesh(const ProcessMesh&) = delete;
+    ProcessMesh& operator=(const ProcessMesh&) = delete;
+
+    // Rank 0 waits for the other processes to exit.
+    ~ProcessMesh() {
+        for (auto& peer : _peers) {
+            if (peer.fd >= 0) close(peer.fd);
+        }
+        for (pid_t pid : _children) {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    size_t rank() const { return _rank; }
+    size_t size() const { return _peers.size(); }
+
+    // Whether peer has exited or closed its end.
+    bool closed(size_t peer) const { return peer != _rank && _peers[peer].closed; }
+
+    void send(size_t peer, uint8_t type, const std::string& payload) {
+        auto& out = _peers[peer].out;
+        uint32_t length = payload.size() + 1;
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.push_back(char(type));
+        out.append(payload);
+        writeSome(_peers[peer]);
+    }
+
+    // Writes what the sockets accept, waits up to timeoutMs (-1 for ever)
+    // for input if none has arrived yet, and appends the messages received
+    // to messages.
+    void poll(int timeoutMs, std::vector<Message>& messages) {
+        bool pending = false;
+        for (auto& peer : _peers) {
+            pending |= hasMessage(peer);
+        }
+        transfer(pending ? 0 : timeoutMs);
+        for (size_t j = 0; j < _peers.size(); j++) {
+            while (hasMessage(_peers[j])) {
+                auto& peer = _peers[j];
+                uint32_t length;
+                memcpy(&length, &peer.in[peer.consumed], sizeof(length));
+                const char* body = &peer.in[peer.consumed + sizeof(length)];
+                messages.push_back(Message{j, uint8_t(body[0]), std::string(body + 1, length - 1)});
+                peer.consumed += sizeof(length) + length;
+            }
+            if (_peers[j].consumed > 0) {
+                _peers[j].in.erase(0, _peers[j].consumed);
+                _peers[j].consumed = 0;
+            }
+        }
+    }
+
+    // Blocks until every message sent so far is written. Input that arrives
+    // meanwhile is kept for poll().
+    void flush() {
+        while (true) {
+            bool pending = false;
+            for (auto& peer : _peers) {
+                pending |= !peer.out.empty() && !peer.closed;
+            }
+            if (!pending) return;
+            transfer(-1);
+        }
+    }
+
+private:
+    static const size_t kCompactBytes = 1 << 20;
+
+    struct Peer {
+        int fd = -1;
+        bool closed = false;
+        std::string out;
+        size_t written = 0;
+        std::string in;
+        size_t consumed = 0;
+    };
+
+    static bool hasMessage(const Peer& peer) {
+        if (peer.in.size() - peer.consumed < sizeof(uint32_t)) return false;
+        uint32_t length;
+        memcpy(&length, &peer.in[peer.consumed], sizeof(length));
+        return peer.in.size() - peer.consumed >= sizeof(length) + length;
+    }
+
+    // One round of poll(): reads whatever is readable and writes whatever is
+    // writable.
+    void transfer(int timeoutMs) {
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for (size_t j = 0; j < _peers.size(); j++) {
+            auto& peer = _peers[j];
+            if (peer.fd < 0 || peer.closed) continue;
+            short events = POLLIN;
+            if (peer.written < peer.out.size()) events |= POLLOUT;
+            fds.push_back(pollfd{peer.fd, events, 0});
+            owners.push_back(j);
+        }
+        if (fds.empty()) return;
+        int n = ::poll(fds.data(), fds.size(), timeoutMs);
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "Cannot poll the checker processes: " << strerror(errno) << std::endl;
+            abort();
+        }
+        for (size_t k = 0; n > 0 && k < fds.size(); k++) {
+            auto& peer = _peers[owners[k]];
+            if (fds[k].revents & POLLOUT) {
+                writeSome(peer);
+            }
+            if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+                readSome(peer);
+            }
+        }
+    }
+
+    static void writeSome(Peer& peer) {
+        while (peer.written < peer.out.size() && !peer.closed) {
+            ssize_t n = ::send(peer.fd, peer.out.data() + peer.written, peer.out.size() - peer.written,
+                               MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (peer.written >= kCompactBytes) {
+                    peer.out.erase(0, peer.written);
+                    peer.written = 0;
+                }
+                return;
+            }
+            if (n < 0) {
+                // The peer is gone; what it would have read does not matter.
+                peer.closed = true;
+                break;
+            }
+            peer.written += n;
+        }
+        peer.out.clear();
+        peer.written = 0;
+    }
+
+    static void readSome(Peer& peer) {
+        char buffer[1 << 16];
+        while (true) {
+            ssize_t n = read(peer.fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if (n <= 0) {
+                peer.closed = true;
+                return;
+            }
+            peer.in.append(buffer, n);
+        }
+    }
+
+    size_t _rank = 0;
+    std::vector<Peer> _peers;
+    std::vector<pid_t> _children;
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+// The BFS frontier. States are popped in the order they were pushed. Only a
+// bounded head (the oldest states) and tail (the newest) are kept in memory;
+// whenever the tail fills up it is encoded with Codec and written out as an
+// append-only segment file. Segments are read back in order, and the next
+// one is read and decoded in the background while the head is consumed.
+//
+// Codec provides
+//     static void encode(const StateType& s, std::string& out);
+//     static StateType decode(const char*& in);
+//
+// Not thread-safe.
+template <class StateType, class Codec>
+class StateQueue {
+public:
+    StateQueue() {}
+    StateQueue(const StateQueue&) = delete;
+    StateQueue& operator=(const StateQueue&) = delete;
+    ~StateQueue() { clear(); }
+
+    // Keeps at most about memoryStates states in memory, spilling the rest to
+    // files under directory. 0 keeps the whole queue in memory.
+    void reset(const std::string& directory, size_t memoryStates) {
+        clear();
+        _directory = directory;
+        // The head, the tail and the segment being prefetched each take a third.
+        _limit = memoryStates == 0 ? SIZE_MAX : std::max<size_t>(1, memoryStates / 3);
+    }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    size_t spilledStates() const { return _size - _head.size() - _tail.size(); }
+
+    void push(StateType state) {
+        _size++;
+        // Nothing is waiting on disk, so the head can take the state directly.
+        if (_segments.empty() && _tail.empty() && _head.size() < _limit) {
+            _head.push_back(std::move(state));
+            return;
+        }
+        _tail.push_back(std::move(state));
+        if (_tail.size() >= _limit) {
+            spillTail();
+        }
+    }
+
+    // The oldest state, which pop() returns next.
+    const StateType& front() {
+        if (_head.empty()) {
+            refillHead();
+        }
+        return _head.front();
+    }
+
+    StateType pop() {
+        if (_head.empty()) {
+            refillHead();
+        }
+        StateType state = std::move(_head.front());
+        _head.pop_front();
+        _size--;
+        return state;
+    }
+
+    // Writes the queued states to a checkpoint, oldest first, as chunks of
+    // encoded states ending with an empty one. Spilled segments are copied
+    // over as they are.
+    void save(CheckpointWriter& out) const {
+        std::string bytes;
+        auto encode = [&](const StateType& s) {
+            Codec::encode(s, bytes);
+            if (bytes.size() >= kChunkBytes) {
+                out.writeBytes(bytes);
+                bytes.clear();
+            }
+        };
+        for (auto& s : _head) {
+            encode(s);
+        }
+        for (auto& segment : _segments) {
+            if (!bytes.empty()) out.writeBytes(bytes);
+            bytes.assign(segment.bytes, '\0');
+            readAll(segment.fd, &bytes[0], segment.bytes);
+            out.writeBytes(bytes);
+            bytes.clear();
+        }
+        for (auto& s : _tail) {
+            encode(s);
+        }
+        if (!bytes.empty()) out.writeBytes(bytes);
+        out.writeBytes(std::string());
+    }
+
+    // Pushes the states saved by save().
+    void load(CheckpointReader& in) {
+        std::string bytes;
+        for (in.readBytes(bytes); !bytes.empty(); in.readBytes(bytes)) {
+            const char* p = bytes.data();
+            const char* end = p + bytes.size();
+            while (p < end) {
+                push(Codec::decode(p));
+            }
+        }
+    }
+
+private:
+    static const size_t kChunkBytes = 1 << 20;
+
+    struct Segment {
+        int fd = -1;
+        size_t bytes = 0;
+        std::future<std::vector<StateType>> states;
+    };
+
+    void clear() {
+        for (auto& segment : _segments) {
+            if (segment.states.valid()) segment.states.wait();
+            close(segment.fd);
+        }
+        _segments.clear();
+        _head.clear();
+        _tail.clear();
+        _size = 0;
+    }
+
+    void spillTail() {
+        std::string bytes;
+        for (auto& s : _tail) {
+            Codec::encode(s, bytes);
+        }
+        _tail.clear();
+
+        Segment segment;
+        std::string path = _directory + "/checker-" + std::to_string(getpid()) + "-queue-" +
+                           std::to_string(_nextSegmentId++) + ".seg";
+        segment.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (segment.fd < 0) {
+            std::cerr << "Cannot create queue segment " << path << ": " << strerror(errno) << std::endl;
+            abort();
+        }
+        // The descriptor keeps the file alive until the segment is read back.
+        unlink(path.c_str());
+        writeAll(segment.fd, bytes.data(), bytes.size());
+        segment.bytes = bytes.size();
+        _segments.push_back(std::move(segment));
+        if (_segments.size() == 1) {
+            prefetch(_segments.front());
+        }
+    }
+
+    void refillHead() {
+        if (_segments.empty()) {
+            std::move(_tail.begin(), _tail.end(), std::back_inserter(_head));
+            _tail.clear();
+            return;
+        }
+        auto states = _segments.front().states.get();
+        close(_segments.front().fd);
+        _segments.pop_front();
+        std::move(states.begin(), states.end(), std::back_inserter(_head));
+        if (!_segments.empty()) {
+            prefetch(_segments.front());
+        }
+    }
+
+    // Starts reading and decoding the segment on another thread.
+    static void prefetch(Segment& segment) {
+        int fd = segment.fd;
+        size_t bytes = segment.bytes;
+        segment.states = std::async(std::launch::async, [fd, bytes]() {
+            std::string buffer(bytes, '\0');
+            readAll(fd, &buffer[0], bytes);
+            std::vector<StateType> states;
+            const char* in = buffer.data();
+            const char* end = in + bytes;
+            while (in < end) {
+                states.push_back(Codec::decode(in));
+            }
+            return states;
+        });
+    }
+
+    static void writeAll(int fd, const char* data, size_t bytes) {
+        while (bytes > 0) {
+            ssize_t n = write(fd, data, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot write queue segment: " << strerror(errno) << std::endl;
+                abort();
+            }
+            data += n;
+            bytes -= n;
+        }
+    }
+
+    static void readAll(int fd, char* data, size_t bytes) {
+        size_t offset = 0;
+        while (offset < bytes) {
+            ssize_t n = pread(fd, data + offset, bytes - offset, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot read queue segment: " << strerror(errno) << std::endl;
+                abort();
+            }
+            offset += n;
+        }
+    }
+
+    std::string _directory;
+    size_t _limit = SIZE_MAX;
+    size_t _size = 0;
+    size_t _nextSegmentId = 0;
+    std::deque<StateType> _head;
+    std::deque<Segment> _segments;
+    std::vector<StateType> _tail;
+};
+
+// The states one worker holds with the work-stealing scheduler. The owner
+// pushes and pops at the back, so it goes on with the successors it has just
+// found while they are still in cache; idle workers steal the older half from
+// the front. The mutex is only contended during a steal.
+template <class StateType>
+class WorkerDeque {
+public:
+    void push(std::vector<StateType>& states) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        std::move(states.begin(), states.end(), std::back_inserter(_states));
+        states.clear();
+    }
+
+    // Moves up to n of the newest states to out, newest last.
+    void popBack(size_t n, std::vector<StateType>& out) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        n = std::min(n, _states.size());
+        std::move(_states.end() - n, _states.end(), std::back_inserter(out));
+        _states.erase(_states.end() - n, _states.end());
+    }
+
+    // Moves up to n of the oldest states to out.
+    void popFront(size_t n, std::vector<StateType>& out) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        n = std::min(n, _states.size());
+        std::move(_states.begin(), _states.begin() + n, std::back_inserter(out));
+        _states.erase(_states.begin(), _states.begin() + n);
+    }
+
+    // Moves the older half, rounded up, to out.
+    void steal(std::vector<StateType>& out) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        size_t n = (_states.size() + 1) / 2;
+        std::move(_states.begin(), _states.begin() + n, std::back_inserter(out));
+        _states.erase(_states.begin(), _states.begin() + n);
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _states.size();
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::deque<StateType> _states;
+};
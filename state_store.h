@@ -0,0 +1,252 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include "arena.h"
+#include "checkpoint.h"
+#include "fingerprint_set.h"
+
+// Full copies of unique states by fingerprint, kept only to print error
+// traces. A fingerprint inserted again keeps its first state. Both stores
+// share the growing protocol of ConcurrentFingerprintSet. In checkpoints,
+// states are encoded with a Codec as in StateQueue.
+
+// Any state, encoded with Codec, in hash maps sharded by fingerprint so that
+// workers adding new states rarely wait on each other. A shard keeps the
+// encodings and its map nodes in its own arena: adding a state takes no
+// allocation for the containers inside it, nor for the node, and reset()
+// frees a shard at once. Rehashing leaves the old bucket arrays behind in
+// the arena, about as much again as the last one.
+template <class StateType, class Codec>
+class ShardedStateStore {
+public:
+    ShardedStateStore() {
+        for (auto& shard : _shards) {
+            shard.states.reset(new Map(0, FingerprintHash(), std::equal_to<Fingerprint>(), Allocator(&shard.arena)));
+        }
+    }
+
+    // Sizes every shard for its part of capacity states up front, so that
+    // filling the store to capacity does not rehash.
+    void reset(size_t capacity) {
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            // The map lives in the arena, so it goes first.
+            shard.states.reset();
+            shard.arena.clear();
+            shard.states.reset(new Map(0, FingerprintHash(), std::equal_to<Fingerprint>(), Allocator(&shard.arena)));
+            shard.states->reserve(capacity / kShards);
+        }
+    }
+
+    void insert(Fingerprint fp, const StateType& state) {
+        static thread_local std::string bytes;
+        bytes.clear();
+        Codec::encode(state, bytes);
+        insertEncoded(fp, bytes.data(), bytes.size());
+    }
+
+    bool find(Fingerprint fp, StateType* state) const {
+        auto& shard = _shards[fp % kShards];
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        auto it = shard.states->find(fp);
+        if (it == shard.states->end()) return false;
+        const char* p = it->second.data;
+        *state = Codec::decode(p);
+        return true;
+    }
+
+    bool needsGrow() const { return false; }
+    void grow() {}
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            bytes += shard.arena.memoryBytes();
+        }
+        return bytes;
+    }
+
+    // The states are saved as they are kept, so C must be Codec.
+    template <class C>
+    void save(CheckpointWriter& out) const {
+        static_assert(std::is_same<C, Codec>::value, "The store keeps states encoded with its own codec.");
+        uint64_t n = 0;
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            n += shard.states->size();
+        }
+        out.writeValue(n);
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            for (auto& entry : *shard.states) {
+                out.writeValue(entry.first);
+                out.writeValue<uint64_t>(entry.second.size);
+                out.write(entry.second.data, entry.second.size);
+            }
+        }
+    }
+
+    template <class C>
+    void load(CheckpointReader& in) {
+        static_assert(std::is_same<C, Codec>::value, "The store keeps states encoded with its own codec.");
+        uint64_t n = in.readValue<uint64_t>();
+        std::string bytes;
+        for (uint64_t i = 0; i < n; i++) {
+            Fingerprint fp = in.readValue<Fingerprint>();
+            in.readBytes(bytes);
+            insertEncoded(fp, bytes.data(), bytes.size());
+        }
+    }
+
+private:
+    static const size_t kShards = 64;
+
+    struct FingerprintHash {
+        size_t operator()(Fingerprint fp) const { return foldFingerprint(fp); }
+    };
+
+    struct Encoded {
+        const char* data;
+        size_t size;
+    };
+
+    using Allocator = ArenaAllocator<std::pair<const Fingerprint, Encoded>>;
+    using Map = std::unordered_map<Fingerprint, Encoded, FingerprintHash, std::equal_to<Fingerprint>, Allocator>;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        Arena arena;
+        std::unique_ptr<Map> states;
+    };
+
+    void insertEncoded(Fingerprint fp, const char* data, size_t size) {
+        auto& shard = _shards[fp % kShards];
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        shard.states->emplace(fp, Encoded{shard.arena.copy(data, size), size});
+    }
+
+    std::array<Shard, kShards> _shards;
+};
+
+// Trivially copyable states packed into one open-addressing table, with the
+// state bytes inline next to the fingerprint instead of in map nodes. Slots
+// are claimed with a CAS on the key; the state is written before the state
+// is published to other workers through the queue.
+template <class StateType>
+class FlatStateStore {
+    static_assert(std::is_trivially_copyable<StateType>::value, "FlatStateStore needs trivially copyable states.");
+public:
+    void reset(size_t capacity) {
+        size_t slots = 16;
+        while (slots < capacity) slots <<= 1;
+        _slots.reset(new Slot[slots]);
+        _mask = slots - 1;
+        _size = 0;
+    }
+
+    void insert(Fingerprint fp, const StateType& state) {
+        Fingerprint key = fingerprintKey(fp);
+        size_t probes = 0;
+        for (size_t i = key & _mask;; i = (i + 1) & _mask) {
+            Fingerprint expected = kEmpty;
+            if (_slots[i].key.compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+                memcpy(&_slots[i].state, &state, sizeof(StateType));
+                _size.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            // Stored already; the states of one fingerprint are the same.
+            if (expected == key) return;
+            if (++probes > _mask) {
+                std::cerr << "State store is full." << std::endl;
+                abort();
+            }
+        }
+    }
+
+    bool find(Fingerprint fp, StateType* state) const {
+        Fingerprint key = fingerprintKey(fp);
+        for (size_t i = key & _mask, probes = 0; probes <= _mask; i = (i + 1) & _mask, probes++) {
+            Fingerprint k = _slots[i].key.load(std::memory_order_acquire);
+            if (k == kEmpty) return false;
+            if (k == key) {
+                memcpy(static_cast<void*>(state), &_slots[i].state, sizeof(StateType));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool needsGrow() const { return _size.load(std::memory_order_relaxed) * 2 > _mask + 1; }
+
+    size_t memoryBytes() const { return (_mask + 1) * sizeof(Slot); }
+
+    // Doubles the table. Not thread-safe.
+    void grow() {
+        std::unique_ptr<Slot[]> old(std::move(_slots));
+        size_t oldCapacity = _mask + 1;
+        _slots.reset(new Slot[oldCapacity * 2]);
+        _mask = oldCapacity * 2 - 1;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            Fingerprint key = old[i].key.load(std::memory_order_relaxed);
+            if (key == kEmpty) continue;
+            size_t j = key & _mask;
+            while (_slots[j].key.load(std::memory_order_relaxed) != kEmpty) {
+                j = (j + 1) & _mask;
+            }
+            _slots[j].key.store(key, std::memory_order_relaxed);
+            _slots[j].state = old[i].state;
+        }
+    }
+
+    template <class Codec>
+    void save(CheckpointWriter& out) const {
+        out.writeValue<uint64_t>(_size.load(std::memory_order_relaxed));
+        std::string bytes;
+        for (size_t i = 0; i <= _mask; i++) {
+            Fingerprint key = _slots[i].key.load(std::memory_order_relaxed);
+            if (key == kEmpty) continue;
+            StateType state;
+            memcpy(static_cast<void*>(&state), &_slots[i].state, sizeof(StateType));
+            out.writeValue(key);
+            bytes.clear();
+            Codec::encode(state, bytes);
+            out.writeBytes(bytes);
+        }
+    }
+
+    template <class Codec>
+    void load(CheckpointReader& in) {
+        uint64_t n = in.readValue<uint64_t>();
+        std::string bytes;
+        for (uint64_t i = 0; i < n; i++) {
+            if (needsGrow()) grow();
+            Fingerprint key = in.readValue<Fingerprint>();
+            in.readBytes(bytes);
+            const char* p = bytes.data();
+            insert(key, Codec::decode(p));
+        }
+    }
+
+private:
+    static const uint64_t kEmpty = 0;
+
+    struct Slot {
+        std::atomic<Fingerprint> key{kEmpty};
+        typename std::aligned_storage<sizeof(StateType), alignof(StateType)>::type state;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    size_t _mask = 0;
+    std::atomic<size_t> _size{0};
+};